@@ -1,16 +1,33 @@
 #include <algorithm>
 #include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <numeric>
 #include <random>
 #include <thread>
 #include <vector>
 
 #include "blinktree.h"
 
-using Key_t = uint64_t;
-
 using namespace BLINK_TREE;
 
+// heap allocations of the calling thread, reported per operation to show
+// that lookups do not allocate
+static thread_local uint64_t thread_allocations = 0;
+
+void* operator new(size_t size) {
+  thread_allocations++;
+  if (auto ptr = malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
 /**
  * @brief Generate data in random order within the range of [begin, end)
  * @param[out] datas
@@ -23,18 +40,65 @@ void generate_data(T* datas, int begin, int end) {
   std::random_shuffle(datas, datas + end - begin);
 }
 
+/**
+ * @brief key of type key_t for id @p id . Wide keys start with scrambled
+ *        bytes like UUIDs and hashes do, and end with the id to stay unique.
+ */
+template <typename key_t>
+key_t make_key(uint64_t id);
+
+uint64_t scramble(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+template <>
+uint64_t make_key<uint64_t>(uint64_t id) {
+  return id;
+}
+
+template <>
+Key128 make_key<Key128>(uint64_t id) {
+  return {scramble(id), id};
+}
+
+template <>
+FixedKey<16> make_key<FixedKey<16>>(uint64_t id) {
+  FixedKey<16> key;
+  auto words = make_key<Key128>(id);
+  memcpy(key.bytes, &words.high, sizeof(uint64_t));
+  memcpy(key.bytes + sizeof(uint64_t), &id, sizeof(id));
+  return key;
+}
+
+template <>
+FixedKey<32> make_key<FixedKey<32>>(uint64_t id) {
+  FixedKey<32> key;
+  memset(key.bytes, 0, sizeof(key.bytes));
+  auto prefix = scramble(id);
+  memcpy(key.bytes, &prefix, sizeof(prefix));
+  memcpy(key.bytes + 24, &id, sizeof(id));
+  return key;
+}
+
 /**
  * @brief Execute concurrent insert into tree.
  */
-void concurrent_insert(BLinkTree<Key_t>* tree, Key_t* keys, int num_data,
+template <typename key_t>
+void concurrent_insert(BLinkTree<key_t>* tree, key_t* keys, int num_data,
                        int num_threads) {
   size_t chunk = num_data / num_threads;
-  auto insert = [&tree, &keys, chunk, num_data, num_threads](int tid) {
+  std::vector<uint64_t> allocations(num_threads);
+  auto insert = [&tree, &keys, &allocations, chunk, num_data,
+                 num_threads](int tid) {
     int from = chunk * tid;
     int to = chunk * (tid + 1);
+    auto before = thread_allocations;
     for (int i = from; i < to; i++) {
       tree->insert(keys[i], (uint64_t)&keys[i]);
     }
+    allocations[tid] = thread_allocations - before;
   };
 
   std::vector<std::thread> insert_threads;
@@ -54,25 +118,33 @@ void concurrent_insert(BLinkTree<Key_t>* tree, Key_t* keys, int num_data,
   std::cout << "Insertion time: " << insertion_time / 1000000000.0 << " sec" << std::endl;
   std::cout << "throughput: " << num_data / (double)insertion_time * 1000000000.0 / 1000000
             << " mops/sec" << std::endl;
+  std::cout << "allocations per insert: "
+            << std::accumulate(allocations.begin(), allocations.end(), 0ull) /
+                   (double)(chunk * num_threads)
+            << std::endl;
 }
 
 /**
  * @brief Execute concurrent search.
  */
-void concurrent_search(BLinkTree<Key_t>* tree, Key_t* keys, int num_data,
+template <typename key_t>
+void concurrent_search(BLinkTree<key_t>* tree, key_t* keys, int num_data,
                        int num_threads) {
   size_t chunk = num_data / num_threads;
   std::vector<uint64_t> notfound_keys[num_threads];
-  auto search = [&tree, &keys, &notfound_keys, chunk, num_data,
+  std::vector<uint64_t> allocations(num_threads);
+  auto search = [&tree, &keys, &notfound_keys, &allocations, chunk, num_data,
                  num_threads](int tid) {
     int from = chunk * tid;
     int to = chunk * (tid + 1);
+    auto before = thread_allocations;
     for (int i = from; i < to; i++) {
       auto ret = tree->lookup(keys[i]);
       if (ret != (uint64_t)&keys[i]) {
         notfound_keys[tid].push_back(i);
       }
     }
+    allocations[tid] = thread_allocations - before;
   };
 
   std::vector<std::thread> insert_threads;
@@ -91,12 +163,16 @@ void concurrent_search(BLinkTree<Key_t>* tree, Key_t* keys, int num_data,
   std::cout << "Search time: " << search_time / 1000000000.0 << " sec" << std::endl;
   std::cout << "throughput: " << num_data / (double)search_time * 1000000000.0 / 1000000
             << " mops/sec" << std::endl;
+  std::cout << "allocations per lookup: "
+            << std::accumulate(allocations.begin(), allocations.end(), 0ull) /
+                   (double)(chunk * num_threads)
+            << std::endl;
   bool not_found = false;
   for (int i = 0; i < num_threads; i++) {
     for (auto &it : notfound_keys[i]) {
       auto ret = tree->lookup(keys[it]);
       if (ret != (uint64_t)&keys[it]) {
-        std::cout << "key " << keys[it] << " not found" << std::endl;
+        std::cout << "key #" << it << " not found" << std::endl;
         not_found = true;
       }
     }
@@ -104,23 +180,54 @@ void concurrent_search(BLinkTree<Key_t>* tree, Key_t* keys, int num_data,
 
   auto height = tree->height();
   std::cout << "Height of tree: " << height + 1 << std::endl;
+  auto stats = tree->stats();
+  std::cout << "Leaf fill: " << stats.levels[0].fill
+            << ", bytes per key: " << stats.bytes_per_key << std::endl;
+}
+
+/**
+ * @brief insert and search @p num_data random keys of type key_t.
+ */
+template <typename key_t>
+void run(int num_data, int num_threads) {
+  uint64_t* ids = new uint64_t[num_data];
+  generate_data<uint64_t>(ids, 0, num_data);
+  key_t* keys = new key_t[num_data];
+  for (int i = 0; i < num_data; i++) {
+    keys[i] = make_key<key_t>(ids[i]);
+  }
+  delete[] ids;
+
+  auto tree = new BLinkTree<key_t>();
+  std::cout << "InternalNode_Size(" << InternalNode<key_t>::cardinality << "), "
+            << "LeafNode_Size(" << LeafNode<key_t>::cardinality << ")"
+            << std::endl;
+
+  concurrent_insert(tree, keys, num_data, num_threads);
+  concurrent_search(tree, keys, num_data, num_threads);
 }
 
 int main(int argc, char* argv[]) {
   if (argc < 3) {
-    std::cerr << "Usage: " << argv[0] << " num_data num_threads" << std::endl;
+    std::cerr << "Usage: " << argv[0]
+              << " num_data num_threads [u64|u128|fixed16|fixed32]"
+              << std::endl;
     exit(0);
   }
   int num_data = atoi(argv[1]);
   int num_threads = atoi(argv[2]);
-  Key_t* keys = new Key_t[num_data];
-  generate_data<Key_t>(keys, 0, num_data);
+  std::string key_type = argc > 3 ? argv[3] : "u64";
 
-  auto tree = new BLinkTree<Key_t>();
-  std::cout << "InternalNode_Size(" << InternalNode<Key_t>::cardinality << "), "
-            << "LeafNode_Size(" << LeafNode<Key_t>::cardinality << ")"
-            << std::endl;
-
-  concurrent_insert(tree, keys, num_data, num_threads);
-  concurrent_search(tree, keys, num_data, num_threads);
+  if (key_type == "u64") {
+    run<uint64_t>(num_data, num_threads);
+  } else if (key_type == "u128") {
+    run<Key128>(num_data, num_threads);
+  } else if (key_type == "fixed16") {
+    run<FixedKey<16>>(num_data, num_threads);
+  } else if (key_type == "fixed32") {
+    run<FixedKey<32>>(num_data, num_threads);
+  } else {
+    std::cerr << "unknown key type " << key_type << std::endl;
+    exit(1);
+  }
 }
\ No newline at end of file
@@ -0,0 +1,103 @@
+#define PAGE_SIZE (4096)
+#define BUFFER_MANAGER (1)
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "blinktree.h"
+
+using Key_t = uint64_t;
+
+using namespace BLINK_TREE;
+
+/**
+ * @brief Time @p fn and print its throughput over @p num operations.
+ */
+template <typename F>
+void measure(const char* name, int num, F&& fn) {
+  const auto start = std::chrono::high_resolution_clock::now();
+  fn();
+  const auto end = std::chrono::high_resolution_clock::now();
+  const auto time =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  std::cout << name << " time: " << time / 1000000000.0 << " sec" << std::endl;
+  std::cout << "throughput: " << num / (double)time * 1000000000.0 / 1000000
+            << " mops/sec" << std::endl;
+}
+
+/**
+ * @brief Check that @p values holds the values inserted for @p keys .
+ */
+bool check(const Key_t* keys, const uint64_t* values, int num) {
+  for (int i = 0; i < num; i++) {
+    if (values[i] != keys[i] * 2) {
+      std::cout << "key " << keys[i] << " not found" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 4) {
+    std::cerr << "Usage: " << argv[0]
+              << " num_data budget_mb batch_size [pool_file]" << std::endl;
+    exit(0);
+  }
+  int num_data = atoi(argv[1]);
+  uint64_t budget = (uint64_t)atoi(argv[2]) << 20;
+  int batch = atoi(argv[3]);
+  const char* pool_file = argc > 4 ? argv[4] : "bench_io.pool";
+
+  // leaves take about twice their keys once split, reserve ample room
+  uint64_t capacity = std::max<uint64_t>(
+      (uint64_t)num_data * 2 * (sizeof(Key_t) + sizeof(uint64_t)) * 2,
+      64ull << 20);
+  if (!BufferManager::open(pool_file, capacity, budget)) {
+    std::cerr << "cannot create " << pool_file
+              << ", an existing file is not overwritten" << std::endl;
+    exit(1);
+  }
+
+  std::vector<Key_t> keys(num_data);
+  for (int i = 0; i < num_data; i++) {
+    keys[i] = i + 1;
+  }
+  std::mt19937_64 rng(42);
+  std::shuffle(keys.begin(), keys.end(), rng);
+
+  auto tree = new BLinkTree<Key_t>();
+  measure("Insertion", num_data, [&] {
+    for (auto key : keys) {
+      tree->insert(key, key * 2);
+    }
+  });
+  std::cout << "Resident leaves: " << (BufferManager::resident_bytes() >> 20)
+            << " MB of " << (budget >> 20) << " MB budget" << std::endl;
+
+  std::shuffle(keys.begin(), keys.end(), rng);
+  std::vector<uint64_t> values(num_data);
+
+  measure("Synchronous lookup", num_data, [&] {
+    for (int i = 0; i < num_data; i++) {
+      values[i] = tree->lookup(keys[i]);
+    }
+  });
+  bool ok = check(keys.data(), values.data(), num_data);
+
+  std::fill(values.begin(), values.end(), 0);
+  measure("Asynchronous lookup", num_data, [&] {
+    for (int i = 0; i < num_data; i += batch) {
+      tree->async_multi_lookup(keys.data() + i, std::min(batch, num_data - i),
+                               values.data() + i);
+    }
+  });
+  ok = check(keys.data(), values.data(), num_data) && ok;
+
+  std::cout << "Height of tree: " << tree->height() + 1 << std::endl;
+  ::unlink(pool_file);
+  return ok ? 0 : 1;
+}
@@ -1,79 +1,434 @@
 #ifndef BLINK_TREE_
 #define BLINK_TREE_
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
+#include "checkpoint.h"
+#include "epoch.h"
 #include "node.h"
+#include "uring.h"
+#include "wal.h"
 
 namespace BLINK_TREE {
 
-template <typename key_t>
+/**
+ * Fixed capacity stack of traversed internal nodes. It lives in the caller's
+ * frame, so recording the traversal path never allocates.
+ */
+template <typename node_t>
+class NodeStack {
+ public:
+  NodeStack() : cnt(0) {}
+
+  void clear() { cnt = 0; }
+
+  void push_back(node_t* node) { nodes[cnt++] = node; }
+
+  bool empty() const { return cnt == 0; }
+
+  int size() const { return cnt; }
+
+  node_t* operator[](int idx) const { return nodes[idx]; }
+
+ private:
+  node_t* nodes[MAX_HEIGHT];
+  int cnt;
+};  // class NodeStack
+
+template <typename key_t, typename Compare = KeyCompare<key_t>>
 class BLinkTree {
  private:
-  Node* root;
+  using internal_t = InternalNode<key_t, Compare>;
+  using leaf_t = LeafNode<key_t, Compare>;
+
+  std::atomic<Node*> root;  // published once the new root is complete
+  std::atomic<leaf_t*> rightmost_leaf;  // hint for append()
+  uint64_t tree_id;  // identifies this tree in thread local leaf cache
+  EpochManager epoch;  // reclaims unlinked nodes and dropped leaf versions
+  std::atomic<uint64_t> retired_nodes;  // invalidates leaf caches
+
+  // snapshot clock, advanced whenever a snapshot is taken
+  std::atomic<uint64_t> clock;
+  std::mutex snapshot_mutex;              // protects snapshot_ts
+  std::multiset<uint64_t> snapshot_ts;    // clock of live snapshots
+  std::atomic<uint64_t> oldest_snapshot;  // UINT64_MAX if none
+  std::atomic<uint64_t> latest_snapshot;  // latest clock + 1, 0 if none
+
+  WriteAheadLog<key_t>* wal;  // logs modifications, nullptr if not attached
+
+  // with PERSISTENT_TREE, clock when the tree was attached to its file. Older
+  // versions of leaves modified before were kept by a previous process.
+  uint64_t session_clock;
+  // with PERSISTENT_TREE, header of the heap holding root and rightmost leaf,
+  // nullptr without a heap
+  HeapHeader* heap_header;
+
+  // background fuzzy checkpoints, see start_checkpointer()
+  std::thread checkpointer;
+  std::mutex checkpointer_mutex;  // protects checkpointer_stop
+  std::condition_variable checkpointer_cv;
+  bool checkpointer_stop;
+
+  /**
+   * leaf visited by the last lookup_cached() of current thread
+   */
+  struct LeafCache {
+    uint64_t tree_id;
+    uint64_t retired_nodes;  // leaf may be freed once nodes are retired
+    leaf_t* leaf;
+  };
+
+  static inline std::atomic<uint64_t> next_tree_id{1};
 
  public:
-  BLinkTree() { root = static_cast<Node*>(new InternalNode<key_t>()); }
-  ~BLinkTree() {}
+  BLinkTree()
+      : tree_id(next_tree_id.fetch_add(1)),
+        retired_nodes(0),
+        clock(1),
+        oldest_snapshot(UINT64_MAX),
+        latest_snapshot(0),
+        wal(nullptr),
+        session_clock(0),
+        heap_header(PERSISTENT_TREE ? PersistentHeap::header_of() : nullptr),
+        checkpointer_stop(false) {
+    auto heap = heap_header;
+    if (heap && heap->root.load()) {
+      attach(heap);
+      return;
+    }
+    auto leaf = new leaf_t();
+    if (heap) {
+      heap->layout = layout_tag();
+      heap->clock.store(clock.load());
+      leaf->flush();
+      // another process sharing the heap may have created the tree first
+      uint64_t empty = 0;
+      if (!heap->root.compare_exchange_strong(
+              empty, PersistentHeap::to_offset(leaf))) {
+        delete leaf;
+        attach(heap);
+        return;
+      }
+    }
+    set_root(leaf);
+    store_rightmost(leaf);
+  }
+  ~BLinkTree() { stop_checkpointer(); }
 
   /**
-   * @brief insert key-value pair into blinktree
+   * @brief insert key-value pair into blinktree.
+   *        Existing keys are not checked, inserting a key twice stores it
+   *        twice; use upsert() or insert_if_absent() for unique keys.
    */
   void insert(key_t key, uint64_t value) {
+    EpochGuard guard(epoch);
   restart:
-    std::vector<InternalNode<key_t>*> stack;
-    LeafNode<key_t>* leaf = nullptr;
+    NodeStack<internal_t> stack;
+    leaf_t* leaf = nullptr;
     uint64_t leaf_vstart = 0;
-    leaf = traverse_to_leafnode(key, stack, &leaf_vstart);
+    leaf = traverse_to_leafnode(key, &stack, &leaf_vstart);
 
     bool need_restart = false;
     leaf->try_upgrade_writelock(leaf_vstart, need_restart);
     if (need_restart) {
       goto restart;
     }
+    version_leaf(leaf);
+    auto seq = log_record(WAL_PUT, key, key, value);
 
     // leaf node is not full
     if (!leaf->is_full()) {
       leaf->insert(key, value);
-      leaf->write_unlock();
+      write_unlock_counted(&stack, leaf, key, 1);
     } else {  // leaf node split
       backtrack_insertion_split_key(stack, leaf, key, value);
     }
+    log_commit(seq);
+  }
+
+  /**
+   * @brief insert key-value pair, or replace the value if @p key exists.
+   *        Runs in a single traversal under one leaf write lock.
+   * @return true if inserted, false if replaced
+   */
+  bool upsert(key_t key, uint64_t value) {
+    return insert_or_apply(key, value, [value](uint64_t& v) { v = value; });
+  }
+
+  /**
+   * @brief insert key-value pair only if @p key does not exist.
+   *        Runs in a single traversal under one leaf write lock.
+   * @param[out] existing value stored for @p key when it exists, may be nullptr
+   * @return true if inserted, false if @p key exists
+   */
+  bool insert_if_absent(key_t key, uint64_t value,
+                        uint64_t* existing = nullptr) {
+    return insert_or_apply(key, value, [existing](uint64_t& v) {
+      if (existing) *existing = v;
+    });
+  }
+
+  /**
+   * @brief insert @p num key-value pairs into blinktree.
+   *        Keys are grouped by target leaf, so each leaf is traversed to and
+   *        write locked once for all of its keys, and a leaf that overflows is
+   *        split into several new leaves at once. Like insert(), existing keys
+   *        are not checked.
+   * @param sorted true if @p keys is already in ascending order
+   */
+  void insert_batch(const key_t* keys, const uint64_t* values, int num,
+                    bool sorted = false) {
+    if (!sorted) {
+      std::vector<int> order(num);
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(), [keys](int a, int b) {
+        return Compare::less(keys[a], keys[b]);
+      });
+
+      std::vector<key_t> sorted_keys(num);
+      std::vector<uint64_t> sorted_values(num);
+      for (int i = 0; i < num; i++) {
+        sorted_keys[i] = keys[order[i]];
+        sorted_values[i] = values[order[i]];
+      }
+      insert_batch(sorted_keys.data(), sorted_values.data(), num, true);
+      return;
+    }
+
+    int done = 0;
+    while (done < num) {
+      done += insert_leaf_batch(keys + done, values + done, num - done);
+    }
+    if (wal && num) {
+      wal->commit();
+    }
+  }
+
+  /**
+   * @brief insert key-value pair whose key is expected to be greater than the
+   *        keys already in blinktree, e.g. timestamps or sequence ids.
+   *        The key is written straight into the cached rightmost leaf without
+   *        traversal, and a full rightmost leaf is split with split_append()
+   *        so that it stays full. Falls back to insert() when @p key does not
+   *        belong to the rightmost leaf.
+   */
+  void append(key_t key, uint64_t value) {
+    EpochGuard guard(epoch);
+  restart:
+    bool need_restart = false;
+    auto leaf = load_rightmost();
+    auto leaf_vstart = leaf->try_readlock(need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+
+    // the smallest key of rightmost leaf is used as its lower fence
+    if (leaf->sibling_ptr || !leaf->get_cnt() ||
+        Compare::less(key, leaf->low_key())) {
+      insert(key, value);
+      return;
+    }
+
+    leaf->try_upgrade_writelock(leaf_vstart, need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+    version_leaf(leaf);
+
+    // root leaf split needs traversal stack
+    if (leaf->is_full() && (leaf == load_root())) {
+      leaf->write_unlock();
+      insert(key, value);
+      return;
+    }
+    auto seq = log_record(WAL_PUT, key, key, value);
+
+    if (!leaf->is_full()) {
+      leaf->insert(key, value);
+      write_unlock_counted(nullptr, leaf, key, 1);
+      log_commit(seq);
+      return;
+    }
+
+    key_t split_key;
+    auto new_leaf = Compare::less(leaf->high_key, key)
+                        ? leaf->split_append(split_key)
+                        : leaf->split(split_key);
+    if (!Compare::less(split_key, key)) {
+      leaf->insert(key, value);
+    } else {
+      new_leaf->insert(key, value);
+    }
+    store_rightmost(new_leaf);
+    update_splitted_root(split_key, new_leaf, leaf, 1);
+    new_leaf->publish();
+    log_commit(seq);
   }
 
   /**
    * @brief update key-value pair from blinktree
    */
   bool update(key_t key, uint64_t value) {
+    EpochGuard guard(epoch);
   restart:
     bool need_restart = false;
 
-    std::vector<InternalNode<key_t>*> stack;
-    LeafNode<key_t>* leaf = nullptr;
+    leaf_t* leaf = nullptr;
     uint64_t leaf_vstart = 0;
-    leaf = traverse_to_leafnode(key, stack, &leaf_vstart);
+    leaf = traverse_to_leafnode(key, nullptr, &leaf_vstart);
 
     leaf->try_upgrade_writelock(leaf_vstart, need_restart);
     if (need_restart) {
       goto restart;
     }
+    version_leaf(leaf);
 
     bool ret = leaf->update(key, value);
+    auto seq = ret ? log_record(WAL_PUT, key, key, value) : 0;
+    leaf->write_unlock();
+    log_commit(seq);
+
+    return ret;
+  }
+
+  /**
+   * @brief run @p fn on the value of @p key while holding the leaf write lock,
+   *        so read-modify-write sequences on the same key are serialized.
+   * @param fn callable taking uint64_t& , must not access the tree
+   * @return true if @p key exists and @p fn was applied
+   */
+  template <typename F>
+  bool modify(key_t key, F&& fn) {
+    EpochGuard guard(epoch);
+  restart:
+    bool need_restart = false;
+
+    leaf_t* leaf = nullptr;
+    uint64_t leaf_vstart = 0;
+    leaf = traverse_to_leafnode(key, nullptr, &leaf_vstart);
+
+    leaf->try_upgrade_writelock(leaf_vstart, need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+    version_leaf(leaf);
+
+    auto slot = leaf->find_value(key);
+    uint64_t seq = 0;
+    if (slot) {
+      auto old = *slot;
+      fn(*slot);
+      if (*slot != old) {
+        seq = log_record(WAL_PUT, key, key, *slot);
+      }
+    }
     leaf->write_unlock();
+    log_commit(seq);
+    return slot != nullptr;
+  }
 
+  /**
+   * @brief replace the value of @p key with @p desired if it equals
+   *        @p expected .
+   * @param[in,out] expected on failure, set to the stored value (0 if @p key
+   * does not exist)
+   * @return true if replaced
+   */
+  bool compare_exchange(key_t key, uint64_t& expected, uint64_t desired) {
+    bool ret = false;
+    uint64_t cur = 0;
+    modify(key, [&](uint64_t& v) {
+      cur = v;
+      if (v == expected) {
+        v = desired;
+        ret = true;
+      }
+    });
+    if (!ret) {
+      expected = cur;
+    }
     return ret;
   }
 
+  /**
+   * @brief add @p delta to the value of @p key . A missing key counts as 0 and
+   *        is inserted with value @p delta .
+   * @return value before the addition
+   */
+  uint64_t fetch_add(key_t key, uint64_t delta) {
+    uint64_t old = 0;
+    insert_or_apply(key, delta, [&old, delta](uint64_t& v) {
+      old = v;
+      v += delta;
+    });
+    return old;
+  }
+
   /**
    * @brief lookup key from blinktree
    */
   uint64_t lookup(key_t key) {
+    EpochGuard guard(epoch);
   restart:
     bool need_restart = false;
 
-    std::vector<InternalNode<key_t>*> stack;
-    LeafNode<key_t>* leaf = nullptr;
+    leaf_t* leaf = nullptr;
+    uint64_t leaf_vstart = 0;
+    leaf = traverse_to_leafnode(key, nullptr, &leaf_vstart);
+
+    auto ret = leaf->find(key);
+    auto leaf_vend = leaf->get_version(need_restart);
+    if (need_restart || (leaf_vstart != leaf_vend)) {
+      goto restart;
+    }
+
+    return ret;
+  }
+
+  /**
+   * @brief lookup key from blinktree, starting from the leaf visited by the
+   *        previous lookup_cached() of the calling thread.
+   *        The cached leaf is used when @p key lies between its smallest key
+   *        and high_key and its version validates, otherwise the tree is
+   *        traversed from root and the cache is refreshed. Suits sessions
+   *        whose lookups are clustered.
+   */
+  uint64_t lookup_cached(key_t key) {
+    EpochGuard guard(epoch);
+    static thread_local LeafCache cache = {0, 0, nullptr};
+    bool need_restart = false;
+    auto retired = retired_nodes.load();
+
+    if ((cache.tree_id == tree_id) && (cache.retired_nodes == retired)) {
+      auto leaf = cache.leaf;
+      auto leaf_vstart = leaf->try_readlock(need_restart);
+      if (!need_restart && leaf->get_cnt() &&
+          !Compare::less(key, leaf->low_key()) &&
+          (!leaf->sibling_ptr || !Compare::less(leaf->high_key, key))) {
+        auto ret = leaf->find(key);
+        auto leaf_vend = leaf->get_version(need_restart);
+        if (!need_restart && (leaf_vstart == leaf_vend)) {
+          return ret;
+        }
+      }
+    }
+
+  restart:
+    need_restart = false;
+
+    leaf_t* leaf = nullptr;
     uint64_t leaf_vstart = 0;
-    leaf = traverse_to_leafnode(key, stack, &leaf_vstart);
+    leaf = traverse_to_leafnode(key, nullptr, &leaf_vstart);
 
     auto ret = leaf->find(key);
     auto leaf_vend = leaf->get_version(need_restart);
@@ -81,31 +436,261 @@ class BLinkTree {
       goto restart;
     }
 
+    cache.tree_id = tree_id;
+    cache.retired_nodes = retired;
+    cache.leaf = leaf;
     return ret;
   }
 
+  /**
+   * @brief lookup @p num keys from blinktree, values are written to
+   *        @p values in the same order. A key that falls into the leaf of the
+   *        previous key, or into one of the next leaves, reuses that leaf
+   *        instead of traversing from root, so sorted keys are cheapest.
+   */
+  void multi_lookup(const key_t* keys, int num, uint64_t* values) {
+    multi_lookup_run(
+        num, [keys](int i) { return keys[i]; },
+        [values](int i, uint64_t value) { values[i] = value; });
+  }
+
+  /**
+   * @brief lookup @p num keys like multi_lookup(), without blocking on leaves
+   *        evicted from the buffer pool. A probe whose leaf is evicted issues
+   *        an asynchronous read and is parked while the calling thread goes
+   *        on with the next keys, it resumes from root once the read
+   *        completes. Reads are submitted in batches through io_uring with up
+   *        to @p queue_depth leaves in flight, probes of a leaf already being
+   *        read wait for that read. Behaves like multi_lookup() without a
+   *        buffer pool.
+   */
+  void async_multi_lookup(const key_t* keys, int num, uint64_t* values,
+                          int queue_depth = ASYNC_QUEUE_DEPTH) {
+    EpochGuard guard(epoch);
+    static thread_local IoRing ring;
+    if (ring.capacity() < (unsigned)queue_depth) {
+      ring.init(queue_depth);
+    }
+
+    // returns the evicted node that stopped probe i, nullptr once done
+    auto probe = [&](int i, bool may_park) -> Node* {
+    restart:
+      bool need_restart = false;
+      uint64_t leaf_vstart = 0;
+      Node* missing = nullptr;
+      auto leaf = traverse_to_leafnode(keys[i], nullptr, &leaf_vstart,
+                                       may_park ? &missing : nullptr);
+      if (!leaf) {
+        return missing;
+      }
+      auto ret = leaf->find(keys[i]);
+      auto leaf_vend = leaf->get_version(need_restart);
+      if (need_restart || (leaf_vstart != leaf_vend)) {
+        goto restart;
+      }
+      values[i] = ret;
+      return nullptr;
+    };
+
+    // reads in flight, probes waiting for a read are chained through
+    // next_waiter
+    std::vector<Node*> read_node(queue_depth, nullptr);
+    std::vector<int> read_waiters(queue_depth, -1);
+    std::vector<int> free_reads(queue_depth);
+    std::iota(free_reads.begin(), free_reads.end(), 0);
+    std::vector<int> next_waiter(num);
+    // a probe resumed after its read faults in synchronously, so a leaf
+    // evicted again before the probe ran cannot starve it
+    std::vector<bool> was_read(num, false);
+    std::vector<int> ready;  // parked probes to resume
+    std::vector<int> busy;   // probes of leaves loaded by other threads
+    int next = 0;
+    int inflight = 0;
+
+    while ((next < num) || !ready.empty() || !busy.empty() || inflight) {
+      while ((inflight < queue_depth) && (!ready.empty() || (next < num))) {
+        int i;
+        if (!ready.empty()) {
+          i = ready.back();
+          ready.pop_back();
+        } else {
+          i = next++;
+        }
+        auto missing = probe(i, !was_read[i]);
+        if (!missing) {
+          continue;
+        }
+
+        int read = std::find(read_node.begin(), read_node.end(), missing) -
+                   read_node.begin();
+        if (read == queue_depth) {
+          BufferManager::PageRead page;
+          auto status = BufferManager::start_load(missing, &page);
+          if (status == BufferManager::LOAD_BUSY) {
+            busy.push_back(i);
+            continue;
+          }
+          if (status == BufferManager::LOAD_RESIDENT) {
+            probe(i, false);
+            continue;
+          }
+          read = free_reads.back();
+          free_reads.pop_back();
+          read_node[read] = missing;
+          read_waiters[read] = -1;
+          ring.read(page.fd, page.buf, BUFFER_PAGE_SIZE, page.offset, read);
+          inflight++;
+        }
+        next_waiter[i] = read_waiters[read];
+        read_waiters[read] = i;
+      }
+
+      ring.submit();
+      if (inflight) {
+        ring.wait();
+        ring.reap([&](uint64_t read, int64_t result) {
+          BufferManager::finish_load(read_node[read], result);
+          for (int i = read_waiters[read]; i >= 0; i = next_waiter[i]) {
+            was_read[i] = true;
+            ready.push_back(i);
+          }
+          read_node[read] = nullptr;
+          free_reads.push_back(read);
+          inflight--;
+        });
+      } else if (!busy.empty()) {
+        std::this_thread::yield();
+      }
+      ready.insert(ready.end(), busy.begin(), busy.end());
+      busy.clear();
+    }
+  }
+
+  /**
+   * @brief lookup @p num keys with @p num_threads threads, values are written
+   *        to @p values in the same order.
+   *        Keys are partitioned by key range using the separators of the top
+   *        levels of blinktree, every partition is sorted and then probed in
+   *        order by multi_lookup(), so each thread walks its own part of the
+   *        leaf level.
+   */
+  void parallel_multi_lookup(const key_t* keys, int num, uint64_t* values,
+                             int num_threads) {
+    if (num_threads <= 1 || num < num_threads) {
+      multi_lookup(keys, num, values);
+      return;
+    }
+
+    struct Probe {
+      key_t key;
+      int idx;
+    };
+
+    auto splitters = collect_separators(num_threads * 4);
+    int num_parts = splitters.size() + 1;
+    auto part_of = [&splitters](key_t key) {
+      return std::upper_bound(splitters.begin(), splitters.end(), key,
+                              key_less) -
+             splitters.begin();
+    };
+
+    // partition probes by key range, every thread scatters its own chunk
+    std::vector<std::vector<int>> counts(num_threads,
+                                         std::vector<int>(num_parts + 1, 0));
+    std::vector<Probe> probes(num);
+    std::vector<int> part_begin(num_parts + 1, 0);
+    int chunk = (num + num_threads - 1) / num_threads;
+    run_threads(num_threads, [&](int tid) {
+      int from = std::min(num, chunk * tid);
+      int to = std::min(num, chunk * (tid + 1));
+      for (int i = from; i < to; i++) {
+        counts[tid][part_of(keys[i])]++;
+      }
+    });
+    for (int p = 0, pos = 0; p < num_parts; p++) {
+      part_begin[p] = pos;
+      for (int tid = 0; tid < num_threads; tid++) {
+        int cnt = counts[tid][p];
+        counts[tid][p] = pos;
+        pos += cnt;
+      }
+    }
+    part_begin[num_parts] = num;
+    run_threads(num_threads, [&](int tid) {
+      int from = std::min(num, chunk * tid);
+      int to = std::min(num, chunk * (tid + 1));
+      for (int i = from; i < to; i++) {
+        probes[counts[tid][part_of(keys[i])]++] = {keys[i], i};
+      }
+    });
+
+    // assign contiguous partitions to threads with balanced probe counts
+    std::vector<int> thread_begin(num_threads + 1, num);
+    thread_begin[0] = 0;
+    for (int p = 0, tid = 1; (p < num_parts) && (tid < num_threads); p++) {
+      if (part_begin[p + 1] >= (int64_t)num * tid / num_threads) {
+        thread_begin[tid++] = part_begin[p + 1];
+      }
+    }
+
+    run_threads(num_threads, [&](int tid) {
+      auto begin = probes.begin() + thread_begin[tid];
+      auto end = probes.begin() + thread_begin[tid + 1];
+      std::sort(begin, end, [](const Probe& a, const Probe& b) {
+        return Compare::less(a.key, b.key);
+      });
+      multi_lookup_run(
+          end - begin, [&begin](int i) { return begin[i].key; },
+          [&begin, values](int i, uint64_t value) {
+            values[begin[i].idx] = value;
+          });
+    });
+  }
+
   /**
    * @brief remove key-value pair from blinktree
    */
   bool remove(key_t key) {
+    EpochGuard guard(epoch);
   restart:
     bool need_restart = false;
 
-    std::vector<InternalNode<key_t>*> stack;
-    LeafNode<key_t>* leaf = nullptr;
+    leaf_t* leaf = nullptr;
     uint64_t leaf_vstart = 0;
-    leaf = traverse_to_leafnode(key, stack, &leaf_vstart);
+    leaf = traverse_to_leafnode(key, nullptr, &leaf_vstart);
 
     leaf->try_upgrade_writelock(leaf_vstart, need_restart);
     if (need_restart) {
       goto restart;
     }
+    version_leaf(leaf);
 
     auto ret = leaf->remove(key);
-    leaf->write_unlock();
+    auto seq = ret ? log_record(WAL_DEL, key) : 0;
+    write_unlock_counted(nullptr, leaf, key, ret ? -1 : 0);
+    log_commit(seq);
     return ret;
   }
 
+  /**
+   * @brief remove all keys within [ @p low_key , @p high_key ), e.g. everything
+   *        older than a retention horizon.
+   *        The leaf level is walked once from the leaf of @p low_key with lock
+   *        coupling. Afterwards, level by level, every node in the range whose
+   *        entries fit into its left sibling under the same parent is merged
+   *        into it, so emptied leaves and internal subtrees are unlinked from
+   *        their parent and sibling chain. Leaves holding older versions for
+   *        snapshots are not merged. Unlinked nodes are freed once no running
+   *        operation can reach them.
+   * @return number of removed keys
+   */
+  uint64_t remove_range(key_t low_key, key_t high_key) {
+    if (!Compare::less(low_key, high_key)) {
+      return 0;
+    }
+    return remove_range_impl(low_key, high_key, false);
+  }
+
   /**
    * @brief lookup continuous @p range values greater than or equal to @p min_key .
    * @param min_key lookup begin
@@ -114,13 +699,13 @@ class BLinkTree {
    * @return the amount of values found out
    */
   int range_lookup(key_t min_key, int range, uint64_t* buf) {
+    EpochGuard guard(epoch);
   restart:
     bool need_restart = false;
 
-    std::vector<InternalNode<key_t>*> stack;
-    LeafNode<key_t>* leaf = nullptr;
+    leaf_t* leaf = nullptr;
     uint64_t leaf_vstart = 0;
-    leaf = traverse_to_leafnode(min_key, stack, &leaf_vstart);
+    leaf = traverse_to_leafnode(min_key, nullptr, &leaf_vstart);
 
     int count = 0;
     auto idx = leaf->find_lowerbound(min_key);
@@ -145,7 +730,7 @@ class BLinkTree {
         goto restart;
       }
 
-      leaf = static_cast<LeafNode<key_t>*>(sibling);
+      leaf = static_cast<leaf_t*>(sibling);
       leaf_vstart = sibling_vstart;
       count = ret;
       idx = 0;
@@ -154,65 +739,1652 @@ class BLinkTree {
   }
 
   /**
-   * @brief return the height of blinktree
+   * Consistent read only view of blinktree at the time snapshot() was called.
+   * Reading through a snapshot does not block writers, they keep the older
+   * versions of leaves it may read until it is destroyed.
    */
-  int height() { return root->level; }
+  class Snapshot {
+   public:
+    Snapshot(Snapshot&& other) : tree(other.tree), ts(other.ts) {
+      other.tree = nullptr;
+    }
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot() {
+      if (tree) {
+        tree->release_snapshot(ts);
+      }
+    }
+
+    /**
+     * @brief lookup key as of the snapshot, 0 if it did not exist.
+     */
+    uint64_t lookup(key_t key) { return tree->snapshot_lookup(ts, key); }
+
+    /**
+     * @brief range_lookup() as of the snapshot, consistent across leaves.
+     */
+    int range_lookup(key_t min_key, int range, uint64_t* buf) {
+      return tree->snapshot_range_lookup(ts, min_key, range, buf);
+    }
+
+   private:
+    friend class BLinkTree;
+    Snapshot(BLinkTree* _tree, uint64_t _ts) : tree(_tree), ts(_ts) {}
+
+    BLinkTree* tree;
+    uint64_t ts;  // snapshot clock, versions up to ts are visible
+  };
 
- private:
   /**
-   * @brief traverse tree from root to leaf by @p key
-   * @param key lookup key
-   * @param[out] stacks traversed nodes ptr
-   * @param[out] leaf_version_start leafnode's read lock version
-   * @return traversed leaf node
+   * @brief take a snapshot of blinktree. Every modification whose leaf write
+   *        started before this call is visible through the snapshot, later
+   *        ones are not. Writers copy a leaf before its first modification
+   *        after the snapshot, so long lived snapshots cost memory.
    */
-  LeafNode<key_t>* traverse_to_leafnode(
-      key_t key, std::vector<InternalNode<key_t>*>& stacks,
-      uint64_t* leaf_version_start) {
-  restart:
-    auto cur = root;
-    stacks.clear();
-    stacks.reserve(root->level);
+  Snapshot snapshot() {
+    std::lock_guard<std::mutex> guard(snapshot_mutex);
+    auto ts = clock.load();
+    snapshot_ts.insert(ts);
+    oldest_snapshot.store(*snapshot_ts.begin());
+    latest_snapshot.store(ts + 1);
+    if (PERSISTENT_TREE && PersistentHeap::header_of()) {
+      // leaves in the file never carry a clock beyond the stored one
+      auto heap = PersistentHeap::header_of();
+      heap->clock.store(ts + 1);
+      PersistentHeap::persist(heap, sizeof(*heap));
+    }
+    // published before writers can observe the new clock
+    clock.fetch_add(1);
+    return Snapshot(this, ts);
+  }
 
-    bool need_restart = false;
-    auto cur_vstart = cur->try_readlock(need_restart);
-    if (need_restart) {
-      goto restart;
+  /**
+   * @brief write all keys to a checkpoint file at @p path (see
+   *        checkpoint.h), streaming the leaf level from left to right. The
+   *        image is taken from a snapshot, so it is consistent while writers
+   *        continue. An existing file is only replaced by a complete one.
+   * @param[out] wal_seq last record of the attached log the file covers, may
+   * be nullptr
+   * @return false on I/O error
+   */
+  bool save(const char* path, uint64_t* wal_seq = nullptr) {
+    auto writer = std::make_unique<CheckpointWriter<key_t>>();
+    if (!writer->open(path)) {
+      return false;
     }
+    // a record is numbered under the leaf write lock after the leaf took the
+    // clock, so records up to seq are visible through the snapshot
+    uint64_t seq = wal ? wal->last_seq() : 0;
+    auto snap = snapshot();
+    bool ok = true;
+    bool resumed = false;
+    key_t last_key{};
+    snapshot_scan(
+        snap.ts,
+        [&](key_t key, uint64_t value) {
+          ok = ok && writer->append(key, value);
+        },
+        resumed, last_key);
+    if (wal_seq) {
+      *wal_seq = seq;
+    }
+    return ok && writer->finish(seq);
+  }
 
-    // tree traversal
-    while (cur->level != 0) {
-      // Find the next node cotains key, may be next level node or next sibling
-      // node.
-      auto child = static_cast<InternalNode<key_t>*>(cur)->scan_node(key);
-      auto child_vstart = child->try_readlock(need_restart);
-      if (need_restart) {
-        goto restart;
-      }
+  /**
+   * @brief save() to @p path , then delete the segments of the attached log
+   *        whose records are all covered by the file.
+   * @return false on I/O error
+   */
+  bool checkpoint(const char* path) {
+    uint64_t seq = 0;
+    if (!save(path, &seq)) {
+      return false;
+    }
+    if (wal) {
+      wal->truncate(seq);
+    }
+    return true;
+  }
 
-      // When execute cur->scan_node(), cur may be changed by other thread.
-      // So if strat_version != cur_version, means cur is changed,
-      //    if need_restart == true, means cur is changing.
-      auto cur_vend = cur->get_version(need_restart);
-      if (need_restart || (cur_vstart != cur_vend)) {
-        goto restart;
+  /**
+   * @brief write all keys to a checkpoint file at @p path while writers
+   *        continue, without taking a snapshot. The leaf level is walked
+   *        through sibling_ptr and each leaf is copied optimistically, so the
+   *        file is fuzzy: every leaf is saved as of the moment it was copied.
+   *        It is consistent together with the attached log replayed from the
+   *        position taken before the walk, see recover(), and the segments
+   *        of the log covered by the file are deleted afterwards. The epoch
+   *        is left every CHECKPOINT_SCAN_LEAVES leaves, where the walk sleeps
+   *        to write no more than @p max_bytes_per_sec (0 for unlimited).
+   * @return false on I/O error or when stopped by stop_checkpointer()
+   */
+  bool fuzzy_checkpoint(const char* path, uint64_t max_bytes_per_sec = 0) {
+    auto writer = std::make_unique<CheckpointWriter<key_t>>();
+    if (!writer->open(path)) {
+      return false;
+    }
+    // every leaf copied from now on holds the effects of records up to seq
+    uint64_t seq = wal ? wal->last_seq() : 0;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t bytes = 0;
+    bool ok = true;
+    bool resumed = false;
+    key_t last_key{};
+    while (!snapshot_scan(
+        UINT64_MAX,
+        [&](key_t key, uint64_t value) {
+          ok = ok && writer->append(key, value);
+          bytes += sizeof(key_t) + sizeof(uint64_t);
+        },
+        resumed, last_key, CHECKPOINT_SCAN_LEAVES)) {
+      if (!ok) {
+        return false;
+      }
+      if (max_bytes_per_sec) {
+        auto due = start + std::chrono::microseconds(
+                               (uint64_t)(1e6 * bytes / max_bytes_per_sec));
+        std::unique_lock<std::mutex> guard(checkpointer_mutex);
+        if (checkpointer_cv.wait_until(guard, due,
+                                       [this] { return checkpointer_stop; })) {
+          return false;
+        }
       }
+    }
+    if (!ok || !writer->finish(seq)) {
+      return false;
+    }
+    if (wal) {
+      wal->truncate(seq);
+    }
+    return true;
+  }
 
-      // If cur->scan_node() return sibling node, continue current level,
-      // else go to next level.
-      if (child != static_cast<InternalNode<key_t>*>(cur)->sibling_ptr) {
-        stacks.push_back(static_cast<InternalNode<key_t>*>(cur));
+  /**
+   * @brief run fuzzy_checkpoint() to @p path every @p interval_ms in a
+   *        background thread until stop_checkpointer().
+   */
+  void start_checkpointer(const char* path, uint64_t interval_ms,
+                          uint64_t max_bytes_per_sec = 0) {
+    stop_checkpointer();
+    checkpointer = std::thread([this, file = std::string(path), interval_ms,
+                                max_bytes_per_sec] {
+      std::unique_lock<std::mutex> guard(checkpointer_mutex);
+      while (!checkpointer_cv.wait_for(guard,
+                                       std::chrono::milliseconds(interval_ms),
+                                       [this] { return checkpointer_stop; })) {
+        guard.unlock();
+        fuzzy_checkpoint(file.c_str(), max_bytes_per_sec);
+        guard.lock();
       }
+    });
+  }
 
-      cur = child;
-      cur_vstart = child_vstart;
+  /**
+   * @brief stop the background checkpointer, a checkpoint in progress is
+   *        abandoned at its next throttling pause.
+   */
+  void stop_checkpointer() {
+    if (!checkpointer.joinable()) {
+      return;
     }
+    {
+      std::lock_guard<std::mutex> guard(checkpointer_mutex);
+      checkpointer_stop = true;
+    }
+    checkpointer_cv.notify_all();
+    checkpointer.join();
+    checkpointer_stop = false;
+  }
 
-    // get leaf node
-    auto leaf = static_cast<LeafNode<key_t>*>(cur);
-    auto leaf_vstart = cur_vstart;
-    while (leaf->sibling_ptr && (leaf->high_key < key)) {
-      auto sibling = static_cast<LeafNode<key_t>*>(leaf->sibling_ptr);
+  /**
+   * @brief replace the content of an empty blinktree with the checkpoint at
+   *        @p path . The file is mapped, its blocks are verified and decoded
+   *        into full leaves by @p num_threads threads, and internal levels
+   *        are built bottom up, so no key is inserted one by one. Must not
+   *        run concurrently with other operations.
+   * @param[out] wal_seq last log record covered by the file, may be nullptr
+   * @return false if blinktree is not empty or the file is missing, corrupt or
+   * written for another key type
+   */
+  bool load(const char* path,
+            int num_threads = std::thread::hardware_concurrency(),
+            uint64_t* wal_seq = nullptr) {
+    if (load_root()->level || load_root()->get_cnt()) {
+      return false;
+    }
+    CheckpointReader<key_t> reader;
+    if (!reader.open(path)) {
+      return false;
+    }
+    if (wal_seq) {
+      *wal_seq = reader.wal_seq();
+    }
+    if (!reader.num_keys()) {
+      return true;
+    }
+
+    num_threads = std::max(num_threads, 1);
+    uint64_t num_keys = reader.num_keys();
+    uint64_t num_blocks = reader.num_blocks();
+    uint64_t leaf_cap = leaf_t::cardinality;
+    uint64_t num_leaves = (num_keys + leaf_cap - 1) / leaf_cap;
+    std::vector<Node*> leaves(num_leaves, nullptr);
+    std::vector<key_t> low_keys(num_leaves);
+    std::vector<key_t> high_keys(num_leaves);
+    std::vector<uint64_t> counts(num_leaves);
+    std::atomic<bool> ok{true};
+
+    run_threads(num_threads, [&](int tid) {
+      for (uint64_t b = tid; b < num_blocks; b += num_threads) {
+        if (!reader.verify_block(b)) {
+          ok = false;
+        }
+      }
+    });
+
+    // every thread decodes a contiguous run of leaves, a leaf is published
+    // once it is linked to its successor
+    auto ts = clock.load();
+    run_threads(num_threads, [&](int tid) {
+      uint64_t from = num_leaves * tid / num_threads;
+      uint64_t to = num_leaves * (tid + 1) / num_threads;
+      for (uint64_t i = from; (i < to) && ok; i++) {
+        auto leaf = new leaf_t();
+        leaf->version_ts = ts;
+        leaves[i] = leaf;
+        if (i > from) {
+          leaves[i - 1]->sibling_ptr = leaf;
+          leaves[i - 1]->publish();
+        }
+        uint64_t pos = i * leaf_cap;
+        uint64_t end = std::min(num_keys, pos + leaf_cap);
+        while (pos < end) {
+          uint64_t b = pos / CHECKPOINT_BLOCK_ENTRIES;
+          uint64_t off = pos % CHECKPOINT_BLOCK_ENTRIES;
+          int n = std::min(end - pos, CHECKPOINT_BLOCK_ENTRIES - off);
+          leaf->append_sorted(reader.keys_of(b) + off, reader.values_of(b) + off,
+                              n);
+          pos += n;
+        }
+        for (int j = 1; j < leaf->get_cnt(); j++) {
+          if (Compare::less(leaf->key_at(j), leaf->key_at(j - 1))) {
+            ok = false;
+          }
+        }
+        low_keys[i] = leaf->low_key();
+        high_keys[i] = leaf->high_key;
+        counts[i] = leaf->get_cnt();
+      }
+    });
+    for (uint64_t i = 0; ok && (i + 1 < num_leaves); i++) {
+      if (Compare::less(low_keys[i + 1], high_keys[i])) {
+        ok = false;
+      }
+    }
+    for (int tid = 0; ok && (tid < num_threads); tid++) {
+      uint64_t last = num_leaves * (tid + 1) / num_threads - 1;
+      if (last < num_leaves * tid / num_threads) {
+        continue;  // empty run
+      }
+      if (last + 1 < num_leaves) {
+        leaves[last]->sibling_ptr = leaves[last + 1];
+      }
+      leaves[last]->publish();
+    }
+    if (!ok) {
+      for (auto leaf : leaves) {
+        delete static_cast<leaf_t*>(leaf);
+      }
+      return false;
+    }
+
+    auto old_root = load_root();
+    store_rightmost(static_cast<leaf_t*>(leaves.back()));
+    auto new_root = build_levels(leaves, high_keys, counts);
+    if constexpr (PERSISTENT_TREE) {
+      // the new nodes are durable before the root refers to them
+      PersistentHeap::sync();
+    }
+    set_root(new_root);
+    retired_nodes.fetch_add(1);
+    epoch.retire(old_root, free_node);
+    return true;
+  }
+
+  /**
+   * @brief log every later modification to @p log (see wal.h), nullptr to
+   *        stop logging. Operations return once their records are durable as
+   *        configured for @p log . Must not run concurrently with other
+   *        operations.
+   */
+  void set_wal(WriteAheadLog<key_t>* log) { wal = log; }
+
+  /**
+   * @brief restore an empty blinktree after a restart and attach @p log .
+   *        The checkpoint at @p path is loaded if it exists, then the records
+   *        of @p log after it are replayed by @p num_threads threads. Records
+   *        of one key are applied in sequence order by the thread its key
+   *        hashes to, and a range removal once all records before it are.
+   *        Inserts are replayed as upserts, so a key stored twice by insert()
+   *        is restored once. Must not run concurrently with other operations.
+   * @return false if the checkpoint exists but cannot be loaded
+   */
+  bool recover(const char* path, WriteAheadLog<key_t>* log,
+               int num_threads = std::thread::hardware_concurrency()) {
+    wal = nullptr;
+    uint64_t seq = 0;
+    if ((::access(path, F_OK) == 0) && !load(path, num_threads, &seq)) {
+      return false;
+    }
+    log->advance_seq(seq);
+
+    num_threads = std::max(num_threads, 1);
+    auto records = log->read_records(seq);
+    std::vector<std::vector<size_t>> parts(num_threads);
+    size_t i = 0;
+    while (i < records.size()) {
+      size_t end = i;
+      while ((end < records.size()) && (records[end].type != WAL_DEL_RANGE)) {
+        end++;
+      }
+      // short runs between range removals are not worth threads
+      if (end - i < 4096) {
+        for (; i < end; i++) {
+          replay_record(records[i]);
+        }
+      } else {
+        for (auto& part : parts) {
+          part.clear();
+        }
+        for (; i < end; i++) {
+          parts[std::hash<key_t>{}(records[i].key) % num_threads].push_back(i);
+        }
+        run_threads(num_threads, [&](int tid) {
+          for (auto idx : parts[tid]) {
+            replay_record(records[idx]);
+          }
+        });
+      }
+      if (i < records.size()) {
+        replay_record(records[i++]);
+      }
+    }
+
+    wal = log;
+    return true;
+  }
+
+#if ORDER_STATS
+  /**
+   * @brief number of keys less than @p key , from the subtree counts of the
+   *        nodes on the path to @p key . Exact when no writer is in flight,
+   *        otherwise keys whose counts are still being propagated up may be
+   *        missed.
+   */
+  uint64_t rank(key_t key) {
+    EpochGuard guard(epoch);
+  restart:
+    uint64_t ret = 0;
+    bool need_restart = false;
+    auto cur = load_root();
+    auto cur_vstart = cur->try_readlock(need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+
+    while (true) {
+      Node* next = nullptr;
+      if (cur->level) {
+        auto node = static_cast<internal_t*>(cur);
+        if (node->sibling_ptr && Compare::less(node->high_key, key)) {
+          ret += node->total_count();
+          next = node->sibling_ptr;
+        } else {
+          int pos = node->find_lowerbound(key);
+          for (int i = 0; i < pos; i++) {
+            ret += node->count_at(i);
+          }
+          next = node->child_at(pos);
+        }
+      } else {
+        auto leaf = static_cast<leaf_t*>(cur);
+        if (leaf->sibling_ptr && Compare::less(leaf->high_key, key)) {
+          ret += leaf->get_cnt();
+          next = leaf->sibling_ptr;
+        } else {
+          ret += leaf->find_lowerbound(key);
+        }
+      }
+
+      if (!next) {
+        auto cur_vend = cur->get_version(need_restart);
+        if (need_restart || (cur_vstart != cur_vend)) {
+          goto restart;
+        }
+        return ret;
+      }
+
+      auto next_vstart = next->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+      auto cur_vend = cur->get_version(need_restart);
+      if (need_restart || (cur_vstart != cur_vend)) {
+        goto restart;
+      }
+      cur = next;
+      cur_vstart = next_vstart;
+    }
+  }
+
+  /**
+   * @brief find the @p k th smallest key (starting from 0).
+   * @param[out] key found key
+   * @return false if blinktree holds no more than @p k keys
+   */
+  bool select(uint64_t k, key_t& key) {
+    EpochGuard guard(epoch);
+  restart:
+    uint64_t remain = k;
+    bool need_restart = false;
+    auto cur = load_root();
+    auto cur_vstart = cur->try_readlock(need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+
+    while (true) {
+      Node* next = nullptr;
+      bool found = false;
+      if (cur->level) {
+        auto node = static_cast<internal_t*>(cur);
+        for (int i = 0; i <= node->get_cnt(); i++) {
+          if (remain < node->count_at(i)) {
+            next = node->child_at(i);
+            break;
+          }
+          remain -= node->count_at(i);
+        }
+      } else {
+        auto leaf = static_cast<leaf_t*>(cur);
+        if (remain < (uint64_t)leaf->get_cnt()) {
+          key = leaf->key_at(remain);
+          found = true;
+        } else {
+          remain -= leaf->get_cnt();
+        }
+      }
+      // counts not propagated yet, continue with right sibling
+      if (!next && !found) {
+        next = cur->sibling_ptr;
+      }
+
+      if (!next) {
+        auto cur_vend = cur->get_version(need_restart);
+        if (need_restart || (cur_vstart != cur_vend)) {
+          goto restart;
+        }
+        return found;
+      }
+
+      auto next_vstart = next->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+      auto cur_vend = cur->get_version(need_restart);
+      if (need_restart || (cur_vstart != cur_vend)) {
+        goto restart;
+      }
+      cur = next;
+      cur_vstart = next_vstart;
+    }
+  }
+
+  /**
+   * @brief number of keys within [ @p low_key , @p high_key ).
+   */
+  uint64_t count_range(key_t low_key, key_t high_key) {
+    if (!Compare::less(low_key, high_key)) {
+      return 0;
+    }
+    auto high_rank = rank(high_key);
+    auto low_rank = rank(low_key);
+    return (high_rank > low_rank) ? high_rank - low_rank : 0;
+  }
+#endif
+
+  /**
+   * @brief estimated number of keys less than @p key , without subtree
+   *        counts. The subtree size of a child at each level is extrapolated
+   *        from the fanout of the nodes on the path to @p key and the fill of
+   *        the leaf it ends in, so the cost is one traversal.
+   */
+  uint64_t rank_estimate(key_t key) {
+    EpochGuard guard(epoch);
+    double positions[MAX_HEIGHT];  // children on the left of path per level
+    double fanouts[MAX_HEIGHT];
+  restart:
+    bool need_restart = false;
+    auto cur = load_root();
+    auto cur_vstart = cur->try_readlock(need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+    auto top = cur->level;
+    for (uint32_t i = 0; i <= top; i++) {
+      positions[i] = 0;
+      fanouts[i] = 1;
+    }
+
+    while (true) {
+      Node* next = nullptr;
+      auto level = cur->level;
+      if (level) {
+        auto node = static_cast<internal_t*>(cur);
+        fanouts[level] = node->get_cnt() + 1;
+        if (node->sibling_ptr && Compare::less(node->high_key, key)) {
+          positions[level] += node->get_cnt() + 1;
+          next = node->sibling_ptr;
+        } else {
+          int pos = node->find_lowerbound(key);
+          positions[level] += pos;
+          next = node->child_at(pos);
+        }
+      } else {
+        auto leaf = static_cast<leaf_t*>(cur);
+        fanouts[0] = std::max(leaf->get_cnt(), 1);
+        if (leaf->sibling_ptr && Compare::less(leaf->high_key, key)) {
+          positions[0] += leaf->get_cnt();
+          next = leaf->sibling_ptr;
+        } else {
+          positions[0] += leaf->find_lowerbound(key);
+        }
+      }
+
+      if (!next) {
+        auto cur_vend = cur->get_version(need_restart);
+        if (need_restart || (cur_vstart != cur_vend)) {
+          goto restart;
+        }
+        break;
+      }
+
+      auto next_vstart = next->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+      auto cur_vend = cur->get_version(need_restart);
+      if (need_restart || (cur_vstart != cur_vend)) {
+        goto restart;
+      }
+      cur = next;
+      cur_vstart = next_vstart;
+    }
+
+    // size of one subtree at the current level, from leaves upwards
+    double ret = positions[0];
+    double subtree = fanouts[0];
+    for (uint32_t i = 1; i <= top; i++) {
+      ret += positions[i] * subtree;
+      subtree *= fanouts[i];
+    }
+    return (uint64_t)ret;
+  }
+
+  /**
+   * @brief estimated number of keys within [ @p low_key , @p high_key ), see
+   *        rank_estimate().
+   */
+  uint64_t count_range_estimate(key_t low_key, key_t high_key) {
+    if (!Compare::less(low_key, high_key)) {
+      return 0;
+    }
+    auto high_rank = rank_estimate(high_key);
+    auto low_rank = rank_estimate(low_key);
+    return (high_rank > low_rank) ? high_rank - low_rank : 0;
+  }
+
+  /**
+   * @brief return the height of blinktree
+   */
+  int height() { return load_root()->level; }
+
+  /**
+   * Result of verify(). A concurrent walk may see some nodes before and
+   * others after a modification, so its counts are approximate then.
+   */
+  struct VerifyReport {
+    bool ok = true;
+    std::string error;            // first violated invariant, empty if ok
+    uint32_t height = 0;          // level of root
+    uint64_t num_keys = 0;
+    uint64_t duplicate_keys = 0;  // keys equal to the key before them
+    uint64_t unlinked_nodes = 0;  // reachable from their left sibling only
+    uint64_t retries = 0;         // node reads repeated due to writers
+    // per level, leaves first: nodes, entries (keys of leaves, children of
+    // internal nodes) and average fraction of node capacity used
+    std::vector<uint64_t> nodes;
+    std::vector<uint64_t> entries;
+    std::vector<double> fill;
+  };
+
+  /**
+   * @brief check the structure of blinktree level by level: keys sorted in
+   *        every node and not greater than its high key, the level of every
+   *        node, high keys increasing along the sibling chain of each level,
+   *        separators equal to the high keys of their children, subtree
+   *        counts with ORDER_STATS, and every node reachable from its parent
+   *        or, only after a crash with PERSISTENT_TREE, its left sibling.
+   *        Nodes are copied under version validation. Without
+   *        @p concurrent , writers must not run meanwhile. With it, only
+   *        invariants that hold for a single node, between neighbours and
+   *        between a child and the separator on its left are checked, since
+   *        writers may not have propagated a split or merge to the parent yet.
+   * @param unique_keys whether equal keys are a violation, false for trees
+   * insert() stored some key twice in
+   * @return the first violation found and statistics of blinktree
+   */
+  VerifyReport verify(bool concurrent = false, bool unique_keys = true) {
+    EpochGuard guard(epoch);
+    VerifyReport report;
+    NodeCopy copy;
+
+    // leftmost node of every level, root first. They are never merged away.
+    std::vector<Node*> heads{load_root()};
+    while (true) {
+      if (!read_node(heads.back(), copy, report.retries)) {
+        report.ok = false;
+        report.error = "leftmost node is obsolete";
+        return report;
+      }
+      if (!copy.node()->level) {
+        break;
+      }
+      heads.push_back(copy.internal()->leftmost_ptr());
+    }
+
+    report.height = heads.size() - 1;
+    report.nodes.assign(heads.size(), 0);
+    report.entries.assign(heads.size(), 0);
+    report.fill.assign(heads.size(), 0.0);
+    for (uint32_t level = 0; level <= report.height; level++) {
+      auto head = heads[report.height - level];
+      auto child_head = level ? heads[report.height - level + 1] : nullptr;
+      verify_level(head, level, child_head, concurrent, unique_keys, report);
+      if (!report.ok) {
+        break;
+      }
+    }
+    return report;
+  }
+
+  /**
+   * Statistics of one level of blinktree, returned by stats().
+   */
+  struct LevelStats {
+    uint64_t nodes = 0;
+    uint64_t entries = 0;  // keys of leaves, children of internal nodes
+    uint64_t bytes = 0;    // allocated for the nodes
+    // fraction of node capacity used: average and percentiles over nodes
+    double fill = 0.0;
+    double fill_p10 = 0.0;
+    double fill_p50 = 0.0;
+    double fill_p90 = 0.0;
+    // nodes the level above does not refer to, and the longest run of nodes
+    // from a child pointer of the level above to the next one, 1 once every
+    // split reached the parent
+    uint64_t unlinked = 0;
+    uint64_t max_chain = 0;
+  };
+
+  /**
+   * Result of stats(). With concurrent writers the counts are approximate.
+   */
+  struct TreeStats {
+    uint32_t height = 0;  // level of root
+    uint64_t num_keys = 0;
+    uint64_t bytes = 0;          // allocated for all nodes
+    double bytes_per_key = 0.0;  // bytes / num_keys, 0 if empty
+    uint64_t retries = 0;        // node reads repeated due to writers
+    std::vector<LevelStats> levels;  // per level, leaves first
+  };
+
+  /**
+   * @brief shape and memory footprint of blinktree: per level node counts,
+   *        fill factors, bytes and sibling chains between the child pointers
+   *        of the level above. Every level is walked along its sibling chain
+   *        with nodes copied under version validation, so writers may run
+   *        meanwhile. Older leaf versions kept for snapshots are not counted.
+   */
+  TreeStats stats() {
+    EpochGuard guard(epoch);
+    TreeStats stats;
+    NodeCopy copy;
+
+    // leftmost node of every level, root first
+    std::vector<Node*> heads{load_root()};
+    while (true) {
+      if (!read_node(heads.back(), copy, stats.retries)) {
+        // leftmost nodes are not merged away, but never use a failed copy
+        stats.retries++;
+        heads.assign(1, load_root());
+        continue;
+      }
+      if (!copy.node()->level) {
+        break;
+      }
+      heads.push_back(copy.internal()->leftmost_ptr());
+    }
+
+    stats.height = heads.size() - 1;
+    stats.levels.resize(heads.size());
+    std::unordered_set<Node*> children, parents_children;
+    for (int level = stats.height; level >= 0; level--) {
+      parents_children.swap(children);
+      children.clear();
+      stats_level(heads[stats.height - level], level,
+                  level < (int)stats.height ? &parents_children : nullptr,
+                  children, stats);
+    }
+    for (auto& level : stats.levels) {
+      stats.bytes += level.bytes;
+    }
+    stats.num_keys = stats.levels[0].entries;
+    stats.bytes_per_key =
+        stats.num_keys ? stats.bytes / (double)stats.num_keys : 0.0;
+    return stats;
+  }
+
+ private:
+  /**
+   * @brief insert @p key with @p value if it does not exist, otherwise call
+   *        @p on_exist with a reference to the stored value while the leaf
+   *        write lock is held.
+   * @return true if inserted, false if @p key exists
+   */
+  template <typename F>
+  bool insert_or_apply(key_t key, uint64_t value, F&& on_exist) {
+    EpochGuard guard(epoch);
+  restart:
+    NodeStack<internal_t> stack;
+    leaf_t* leaf = nullptr;
+    uint64_t leaf_vstart = 0;
+    leaf = traverse_to_leafnode(key, &stack, &leaf_vstart);
+
+    bool need_restart = false;
+    leaf->try_upgrade_writelock(leaf_vstart, need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+    version_leaf(leaf);
+
+    auto slot = leaf->find_value(key);
+    if (slot) {
+      auto old = *slot;
+      on_exist(*slot);
+      auto seq = (*slot != old) ? log_record(WAL_PUT, key, key, *slot) : 0;
+      leaf->write_unlock();
+      log_commit(seq);
+      return false;
+    }
+
+    auto seq = log_record(WAL_PUT, key, key, value);
+    if (!leaf->is_full()) {
+      leaf->insert(key, value);
+      write_unlock_counted(&stack, leaf, key, 1);
+    } else {
+      backtrack_insertion_split_key(stack, leaf, key, value);
+    }
+    log_commit(seq);
+    return true;
+  }
+
+  /**
+   * @brief insert the leading keys of sorted @p keys that belong to the same
+   *        leaf node under one write lock.
+   * @return number of inserted keys
+   */
+  int insert_leaf_batch(const key_t* keys, const uint64_t* values, int num) {
+    EpochGuard guard(epoch);
+  restart:
+    NodeStack<internal_t> stack;
+    leaf_t* leaf = nullptr;
+    uint64_t leaf_vstart = 0;
+    leaf = traverse_to_leafnode(keys[0], &stack, &leaf_vstart);
+
+    bool need_restart = false;
+    leaf->try_upgrade_writelock(leaf_vstart, need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+    version_leaf(leaf);
+
+    int limit = leaf_t::cardinality *
+                    (leaf_t::max_merge_split + 1) -
+                leaf->get_cnt();
+    int n = 1;
+    while ((n < num) && (n < limit) &&
+           (!leaf->sibling_ptr || !Compare::less(leaf->high_key, keys[n]))) {
+      n++;
+    }
+    for (int i = 0; i < n; i++) {
+      log_record(WAL_PUT, keys[i], keys[i], values[i]);
+    }
+
+    leaf_t* new_leaves[leaf_t::max_merge_split];
+    key_t split_keys[leaf_t::max_merge_split];
+    int new_cnt = leaf->merge(keys, values, n, new_leaves, split_keys);
+    if (!new_cnt) {
+      write_unlock_counted(&stack, leaf, keys[0], n);
+      return n;
+    }
+
+    // new leaves stay locked until their split keys reach the parent level
+    for (int i = 0; i < new_cnt; i++) {
+      new_leaves[i]->try_writelock();
+    }
+    if (!new_leaves[new_cnt - 1]->sibling_ptr) {
+      store_rightmost(new_leaves[new_cnt - 1]);
+    }
+
+    // the first split key carries the count of all inserted keys upwards
+    Node* left_node = static_cast<Node*>(leaf);
+    for (int i = 0; i < new_cnt; i++) {
+      insert_into_parent(stack, left_node, split_keys[i], new_leaves[i],
+                         i ? 0 : n);
+      left_node = static_cast<Node*>(new_leaves[i]);
+    }
+    left_node->write_unlock();
+    return n;
+  }
+
+  /**
+   * @brief remove_range() of [ @p low_key , @p high_key ), or
+   *        [ @p low_key , @p high_key ] if @p closed .
+   */
+  uint64_t remove_range_impl(key_t low_key, key_t high_key, bool closed) {
+    uint64_t ret = 0;
+    {
+      EpochGuard guard(epoch);
+      ret = remove_leaf_range(low_key, high_key, closed);
+      // a merge above leaves gives former leftmost children a left sibling
+      // under the same parent, so levels are merged again
+      bool merged = true;
+      while (merged) {
+        merged = false;
+        for (uint32_t level = 0; level < load_root()->level; level++) {
+          if (merge_level_range(low_key, high_key, level) && level) {
+            merged = true;
+          }
+        }
+      }
+    }
+    epoch.reclaim();
+    if (wal && ret) {
+      wal->commit();
+    }
+    return ret;
+  }
+
+  /**
+   * @brief remove keys within [ @p low_key , @p high_key ), or
+   *        [ @p low_key , @p high_key ] if @p closed , from the leaf of
+   *        @p low_key and its right siblings. A leaf stays write locked until
+   *        its right sibling is, so no merge can unlink the sibling meanwhile.
+   *        Each leaf logs the span of keys it removed, so replay does not
+   *        remove keys inserted into leaves already passed.
+   * @return number of removed keys
+   */
+  uint64_t remove_leaf_range(key_t low_key, key_t high_key, bool closed) {
+  restart:
+    leaf_t* leaf = nullptr;
+    uint64_t leaf_vstart = 0;
+    leaf = traverse_to_leafnode(low_key, nullptr, &leaf_vstart);
+
+    bool need_restart = false;
+    leaf->try_upgrade_writelock(leaf_vstart, need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+
+    uint64_t ret = 0;
+    while (true) {
+      version_leaf(leaf);
+      key_t span[2] = {};
+      int removed = leaf->remove_range(low_key, high_key, closed, span);
+      if (removed) {
+        log_record(WAL_DEL_RANGE, span[0], span[1]);
+      }
+      ret += removed;
+      auto sibling = static_cast<leaf_t*>(leaf->sibling_ptr);
+      if (!sibling || !Compare::less(leaf->high_key, high_key)) {
+        write_unlock_counted(nullptr, leaf, leaf->high_key, -removed);
+        return ret;
+      }
+
+      sibling->writelock();
+      write_unlock_counted(nullptr, leaf, leaf->high_key, -removed);
+      leaf = sibling;
+    }
+  }
+
+  /**
+   * @brief walk the nodes of @p level within [ @p low_key , @p high_key ) with
+   *        lock coupling and merge each of them into its left sibling when
+   *        possible, see merge_into_left().
+   * @return true if any node was merged
+   */
+  bool merge_level_range(key_t low_key, key_t high_key, uint32_t level) {
+    auto prev = lock_node_at(low_key, level);
+    if (!prev) {
+      return false;
+    }
+
+    bool merged = false;
+    while (prev->sibling_ptr && Compare::less(high_key_of(prev), high_key)) {
+      auto next = prev->sibling_ptr;
+      next->writelock();
+      if (merge_into_left(prev, next)) {
+        merged = true;
+        continue;
+      }
+      prev->write_unlock();
+      prev = next;
+    }
+    prev->write_unlock();
+    return merged;
+  }
+
+  /**
+   * @brief Move the entries of @p next into its left sibling @p prev and
+   *        remove @p next from their parent, when they fit and both are
+   *        children of the same parent. The rightmost node of a level is
+   *        kept, so rightmost_leaf never points to an unlinked leaf.
+   *        The caller holds the write locks of both nodes.
+   * @return true if merged, @p next is then unlocked as obsolete and retired,
+   * otherwise both nodes stay locked
+   */
+  bool merge_into_left(Node* prev, Node* next) {
+    if (!next->sibling_ptr) {
+      return false;
+    }
+    bool fits = prev->level
+                    ? static_cast<internal_t*>(prev)->can_merge_sibling(
+                          static_cast<internal_t*>(next))
+                    : static_cast<leaf_t*>(prev)->can_merge_sibling(
+                          static_cast<leaf_t*>(next));
+    if (!fits) {
+      return false;
+    }
+    // keep leaves whose older versions snapshots may still read
+    if (!prev->level) {
+      auto prev_leaf = static_cast<leaf_t*>(prev);
+      auto next_leaf = static_cast<leaf_t*>(next);
+      version_leaf(prev_leaf);
+      version_leaf(next_leaf);
+      if (prev_leaf->older || next_leaf->older) {
+        return false;
+      }
+    }
+
+    auto parent = lock_parent(nullptr, next, high_key_of(next));
+    if (!parent) {
+      return false;
+    }
+    int pos = parent->child_pos(next);
+    if ((pos <= 0) || (parent->child_at(pos - 1) != prev)) {
+      parent->write_unlock();
+      return false;
+    }
+
+    // parent first: should a crash leave prev linking next, next is missing
+    // from parent like the right half of a split and is linked again
+    parent->remove_child(pos);
+    parent->write_unlock();
+    if (prev->level) {
+      static_cast<internal_t*>(prev)->merge_sibling(
+          static_cast<internal_t*>(next));
+    } else {
+      static_cast<leaf_t*>(prev)->merge_sibling(
+          static_cast<leaf_t*>(next));
+    }
+    prev->flush();
+    next->write_unlock_obsolete();
+
+    retired_nodes.fetch_add(1);
+    epoch.retire(next, free_node);
+    return true;
+  }
+
+  /**
+   * @brief Called with the write lock of @p leaf held before it is modified.
+   *        On the first modification after a snapshot was taken, the current
+   *        content is copied into the version chain when a snapshot may still
+   *        read it. Versions no live snapshot can read anymore are dropped.
+   */
+  void version_leaf(leaf_t* leaf) {
+    if (PERSISTENT_TREE && (leaf->version_ts < session_clock)) {
+      // the older versions were on the heap of a previous process
+      leaf->older = nullptr;
+    }
+    auto ts = clock.load();
+    if (leaf->version_ts != ts) {
+      if (latest_snapshot.load() > leaf->version_ts) {
+        leaf->older = leaf->clone_version();
+      }
+      leaf->version_ts = ts;
+    }
+    if (!leaf->older) {
+      return;
+    }
+
+    // a snapshot reads the newest version not later than its clock
+    auto oldest = oldest_snapshot.load();
+    auto newer = leaf;
+    while (newer->older && (newer->version_ts > oldest)) {
+      newer = newer->older;
+    }
+    auto unused = newer->older;
+    newer->older = nullptr;
+    while (unused) {
+      auto next = unused->older;
+      epoch.retire(unused, free_node);
+      unused = next;
+    }
+  }
+
+  /**
+   * @brief append a record to the attached log, called with the leaf write
+   *        lock held after version_leaf().
+   * @return sequence number of the record, 0 if no log is attached
+   */
+  uint64_t log_record(uint8_t type, key_t key, key_t high_key = key_t(),
+                      uint64_t value = 0) {
+    return wal ? wal->append(type, key, high_key, value) : 0;
+  }
+
+  /**
+   * @brief wait for the record numbered @p seq to be durable, called after
+   *        the leaf is unlocked so waiting writers do not block others.
+   */
+  void log_commit(uint64_t seq) {
+    if (seq) {
+      wal->commit();
+    }
+  }
+
+  void replay_record(const WalRecord<key_t>& record) {
+    if (record.type == WAL_PUT) {
+      upsert(record.key, record.value);
+    } else if (record.type == WAL_DEL) {
+      remove(record.key);
+    } else {
+      remove_range_impl(record.key, record.high_key, true);
+    }
+  }
+
+  void release_snapshot(uint64_t ts) {
+    {
+      std::lock_guard<std::mutex> guard(snapshot_mutex);
+      snapshot_ts.erase(snapshot_ts.find(ts));
+      if (snapshot_ts.empty()) {
+        oldest_snapshot.store(UINT64_MAX);
+        latest_snapshot.store(0);
+      } else {
+        oldest_snapshot.store(*snapshot_ts.begin());
+        latest_snapshot.store(*snapshot_ts.rbegin() + 1);
+      }
+    }
+    // frees the versions writers dropped since they became unreadable
+    epoch.reclaim();
+  }
+
+  /**
+   * @brief version of @p leaf read by a snapshot at @p ts , nullptr if the
+   *        leaf held nothing then. The caller validates @p leaf afterwards.
+   */
+  static leaf_t* version_at(leaf_t* leaf, uint64_t ts) {
+    auto v = leaf;
+    while (v && (v->version_ts > ts)) {
+      v = v->older;
+    }
+    return v;
+  }
+
+  uint64_t snapshot_lookup(uint64_t ts, key_t key) {
+    EpochGuard guard(epoch);
+  restart:
+    bool need_restart = false;
+
+    leaf_t* leaf = nullptr;
+    uint64_t leaf_vstart = 0;
+    leaf = traverse_to_leafnode(key, nullptr, &leaf_vstart);
+
+    auto version = version_at(leaf, ts);
+    auto ret = version ? version->find(key) : 0;
+    auto leaf_vend = leaf->get_version(need_restart);
+    if (need_restart || (leaf_vstart != leaf_vend)) {
+      goto restart;
+    }
+
+    return ret;
+  }
+
+  /**
+   * @brief range_lookup() of a snapshot at @p ts . An older version may hold
+   *        keys that have moved to other leaves since, so only its keys within
+   *        the current range of the leaf are read.
+   */
+  int snapshot_range_lookup(uint64_t ts, key_t min_key, int range,
+                            uint64_t* buf) {
+    EpochGuard guard(epoch);
+  restart:
+    bool need_restart = false;
+
+    leaf_t* leaf = nullptr;
+    uint64_t leaf_vstart = 0;
+    leaf = traverse_to_leafnode(min_key, nullptr, &leaf_vstart);
+
+    int count = 0;
+    key_t low_key = min_key;  // keys of leaf are not less than low_key
+    bool low_inclusive = true;
+    while (count < range) {
+      auto version = version_at(leaf, ts);
+      auto sibling = leaf->sibling_ptr;
+      auto high_key = leaf->high_key;
+      for (int i = 0; version && (i < version->get_cnt()) && (count < range);
+           i++) {
+        auto key = version->key_at(i);
+        if (sibling && Compare::less(high_key, key)) {
+          break;
+        }
+        if (low_inclusive ? Compare::less(key, low_key)
+                          : !Compare::less(low_key, key)) {
+          continue;
+        }
+        buf[count++] = version->value_at(i);
+      }
+
+      if ((count == range) || !sibling) {
+        auto leaf_vend = leaf->get_version(need_restart);
+        if (need_restart || (leaf_vstart != leaf_vend)) {
+          goto restart;
+        }
+        return count;
+      }
+      auto sibling_vstart = sibling->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+
+      auto leaf_vend = leaf->get_version(need_restart);
+      if (need_restart || (leaf_vstart != leaf_vend)) {
+        goto restart;
+      }
+
+      if (Compare::less(min_key, high_key)) {
+        low_key = high_key;
+        low_inclusive = false;
+      }
+      leaf = static_cast<leaf_t*>(sibling);
+      leaf_vstart = sibling_vstart;
+    }
+    return count;
+  }
+
+  /**
+   * @brief call @p emit (key, value) for the keys of a snapshot at @p ts in
+   *        ascending order, ts UINT64_MAX reads the current leaves. The keys
+   *        of a leaf are emitted once the leaf is validated, a restart
+   *        resumes after the last emitted key.
+   * @param[in,out] resumed whether the scan continues after @p last_key
+   * @param[in,out] last_key keys up to it are emitted, valid once resumed
+   * @param max_leaves leaves to emit before returning, so a long scan can be
+   * continued by another call outside this epoch guard
+   * @return true once the rightmost leaf is emitted
+   */
+  template <typename F>
+  bool snapshot_scan(uint64_t ts, F&& emit, bool& resumed, key_t& last_key,
+                     uint64_t max_leaves = UINT64_MAX) {
+    EpochGuard guard(epoch);
+    Entry<key_t, uint64_t> buf[leaf_t::cardinality];
+    uint64_t leaves = 0;
+  restart:
+    bool need_restart = false;
+
+    leaf_t* leaf = nullptr;
+    uint64_t leaf_vstart = 0;
+    leaf = resumed ? traverse_to_leafnode(last_key, nullptr, &leaf_vstart)
+                   : leftmost_leaf(&leaf_vstart);
+
+    while (true) {
+      int num = 0;
+      auto version = version_at(leaf, ts);
+      auto sibling = leaf->sibling_ptr;
+      auto high_key = leaf->high_key;
+      for (int i = 0; version && (i < version->get_cnt()); i++) {
+        auto key = version->key_at(i);
+        if (sibling && Compare::less(high_key, key)) {
+          break;
+        }
+        // older versions may hold keys already emitted from left leaves
+        if (resumed && !Compare::less(last_key, key)) {
+          continue;
+        }
+        buf[num].key = key;
+        buf[num++].value = version->value_at(i);
+      }
+
+      uint64_t sibling_vstart = 0;
+      if (sibling) {
+        sibling_vstart = sibling->try_readlock(need_restart);
+        if (need_restart) {
+          goto restart;
+        }
+      }
+      auto leaf_vend = leaf->get_version(need_restart);
+      if (need_restart || (leaf_vstart != leaf_vend)) {
+        goto restart;
+      }
+
+      for (int i = 0; i < num; i++) {
+        emit(buf[i].key, buf[i].value);
+      }
+      if (!sibling) {
+        return true;
+      }
+      // all keys up to high_key are emitted, also when leaf held none
+      last_key = high_key;
+      resumed = true;
+      if (++leaves == max_leaves) {
+        return false;
+      }
+      leaf = static_cast<leaf_t*>(sibling);
+      leaf_vstart = sibling_vstart;
+    }
+  }
+
+  /**
+   * @brief install @p node as root, recorded in the heap file with
+   *        PERSISTENT_TREE.
+   */
+  void set_root(Node* node) {
+    node->flush();
+    root.store(node);
+    if (auto heap = heap_header) {
+      heap->root.store(PersistentHeap::to_offset(node));
+      PersistentHeap::flush(&heap->root, sizeof(heap->root));
+    }
+  }
+
+  /**
+   * @brief current root. With PERSISTENT_TREE it is read from the heap, where
+   *        another process sharing the heap may have replaced it.
+   */
+  Node* load_root() {
+    if (PERSISTENT_TREE && heap_header) {
+      return static_cast<Node*>(
+          PersistentHeap::from_offset(heap_header->root.load()));
+    }
+    return root.load();
+  }
+
+  /**
+   * @brief rightmost leaf hint for append(), kept in the heap with
+   *        PERSISTENT_TREE like root.
+   */
+  leaf_t* load_rightmost() {
+    if (PERSISTENT_TREE && heap_header) {
+      return static_cast<leaf_t*>(
+          PersistentHeap::from_offset(heap_header->rightmost.load()));
+    }
+    return rightmost_leaf.load();
+  }
+
+  void store_rightmost(leaf_t* leaf) {
+    if (PERSISTENT_TREE && heap_header) {
+      heap_header->rightmost.store(PersistentHeap::to_offset(leaf));
+    }
+    rightmost_leaf.store(leaf);
+  }
+
+  /**
+   * @brief identifies the node layout of this tree type in a heap file.
+   */
+  static constexpr uint64_t layout_tag() {
+    return ((uint64_t)sizeof(key_t) << 40) | ((uint64_t)PAGE_SIZE << 8) |
+           (ORDER_STATS ? 1 : 0);
+  }
+
+  /**
+   * @brief take over the tree stored in the heap file of @p heap , no node is
+   *        read but those on the rightmost path. The tree of a shared heap
+   *        is in use by other processes, its rightmost leaf is kept as is.
+   */
+  void attach(HeapHeader* heap) {
+    if (heap->layout != layout_tag()) {
+      std::cerr << "heap file holds a tree of another key type or page size"
+                << std::endl;
+      std::abort();
+    }
+    root = static_cast<Node*>(PersistentHeap::from_offset(heap->root.load()));
+    if (PersistentHeap::is_shared()) {
+      // the creating process installs root before the rightmost leaf
+      while (!heap->rightmost.load()) {
+        std::this_thread::yield();
+      }
+      return;
+    }
+    clock.store(heap->clock.load() + 1);
+    session_clock = clock.load();
+    heap->clock.store(clock.load());
+
+    // the rightmost node of every level, descending from root
+    Node* cur = load_root();
+    while (true) {
+      while (cur->sibling_ptr) {
+        cur = cur->sibling_ptr;
+      }
+      if (!cur->level) {
+        break;
+      }
+      auto node = static_cast<internal_t*>(cur);
+      cur = node->child_at(node->get_cnt());
+    }
+    store_rightmost(static_cast<leaf_t*>(cur));
+  }
+
+  /**
+   * @brief traverse tree from root to the leftmost leaf.
+   * @param[out] leaf_version_start leafnode's read lock version
+   */
+  leaf_t* leftmost_leaf(uint64_t* leaf_version_start) {
+  restart:
+    auto cur = load_root();
+    bool need_restart = false;
+    auto cur_vstart = cur->try_readlock(need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+
+    while (cur->level != 0) {
+      auto child = static_cast<internal_t*>(cur)->leftmost_ptr();
+      auto child_vstart = child->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+
+      auto cur_vend = cur->get_version(need_restart);
+      if (need_restart || (cur_vstart != cur_vend)) {
+        goto restart;
+      }
+
+      cur = child;
+      cur_vstart = child_vstart;
+    }
+
+    *leaf_version_start = cur_vstart;
+    return static_cast<leaf_t*>(cur);
+  }
+
+  /**
+   * @brief build full internal levels over linked leaves @p nodes , from left
+   *        to right, until a single root remains. High keys and key counts of
+   *        the leaves are passed in, so leaves are not read again and may
+   *        have been evicted meanwhile.
+   * @return root node
+   */
+  Node* build_levels(std::vector<Node*> nodes, std::vector<key_t> high_keys,
+                     std::vector<uint64_t> counts) {
+    size_t fanout = internal_t::cardinality;
+    uint32_t level = 0;
+    while (nodes.size() > 1) {
+      level++;
+      std::vector<Node*> parents;
+      std::vector<key_t> parent_high_keys;
+      std::vector<uint64_t> parent_counts;
+      for (size_t i = 0; i < nodes.size(); i += fanout) {
+        size_t end = std::min(nodes.size(), i + fanout);
+        auto parent = new internal_t(nullptr, 0, nodes[i], level,
+                                              high_keys[end - 1]);
+        uint64_t total = counts[i];
+        for (size_t j = i + 1; j < end; j++) {
+          parent->append_child(high_keys[j - 1], nodes[j]);
+          total += counts[j];
+        }
+        if constexpr (ORDER_STATS) {
+          for (size_t j = i; j < end; j++) {
+            parent->count_at(j - i) = counts[j];
+          }
+        }
+        if (!parents.empty()) {
+          parents.back()->sibling_ptr = parent;
+        }
+        parents.push_back(parent);
+        parent_high_keys.push_back(high_keys[end - 1]);
+        parent_counts.push_back(total);
+      }
+      nodes.swap(parents);
+      high_keys.swap(parent_high_keys);
+      counts.swap(parent_counts);
+    }
+    return nodes[0];
+  }
+
+  static void free_node(void* ptr) {
+    auto node = static_cast<Node*>(ptr);
+    if (node->level) {
+      delete static_cast<internal_t*>(node);
+    } else {
+      delete static_cast<leaf_t*>(node);
+    }
+  }
+
+  /**
+   * @brief core of multi_lookup(), keys and results are accessed by index
+   *        through @p key_at and @p set_value .
+   */
+  template <typename K, typename V>
+  void multi_lookup_run(int num, K&& key_at, V&& set_value) {
+    EpochGuard guard(epoch);
+    leaf_t* leaf = nullptr;
+    uint64_t leaf_vstart = 0;
+    key_t leaf_low{};  // a key known to belong to leaf, lower fence of reuse
+
+    for (int i = 0; i < num; i++) {
+      auto key = key_at(i);
+      bool need_restart = false;
+
+      if (leaf && !Compare::less(key, leaf_low)) {
+        // sorted keys move right along the leaf level for a few hops
+        for (int hops = 0; (hops < 2) && leaf->sibling_ptr &&
+                           Compare::less(leaf->high_key, key);
+             hops++) {
+          auto sibling = static_cast<leaf_t*>(leaf->sibling_ptr);
+          auto sibling_vstart = sibling->try_readlock(need_restart);
+          auto leaf_vend = leaf->get_version(need_restart);
+          if (need_restart || (leaf_vstart != leaf_vend)) {
+            break;
+          }
+          leaf = sibling;
+          leaf_vstart = sibling_vstart;
+          leaf_low = key;
+        }
+
+        if (!need_restart &&
+            (!leaf->sibling_ptr || !Compare::less(leaf->high_key, key))) {
+          auto ret = leaf->find(key);
+          auto leaf_vend = leaf->get_version(need_restart);
+          if (!need_restart && (leaf_vstart == leaf_vend)) {
+            set_value(i, ret);
+            continue;
+          }
+        }
+      }
+
+    restart:
+      need_restart = false;
+      leaf = traverse_to_leafnode(key, nullptr, &leaf_vstart);
+      auto ret = leaf->find(key);
+      auto leaf_vend = leaf->get_version(need_restart);
+      if (need_restart || (leaf_vstart != leaf_vend)) {
+        goto restart;
+      }
+      leaf_low = key;
+      set_value(i, ret);
+    }
+  }
+
+  /**
+   * @brief collect sorted separator keys of the top internal levels, going
+   *        down level by level until at least @p min_count are found or the
+   *        level above leaves is reached.
+   */
+  std::vector<key_t> collect_separators(size_t min_count) {
+    EpochGuard guard(epoch);
+    std::vector<key_t> separators;
+  restart:
+    separators.clear();
+    bool need_restart = false;
+    auto level_head = load_root();
+    while (level_head->level != 0) {
+      separators.clear();
+      auto node = static_cast<internal_t*>(level_head);
+      Node* next_head = nullptr;
+      while (node) {
+        auto vstart = node->try_readlock(need_restart);
+        if (need_restart) {
+          goto restart;
+        }
+        for (int i = 0; i < node->get_cnt(); i++) {
+          separators.push_back(node->key_at(i));
+        }
+        auto sibling = static_cast<internal_t*>(node->sibling_ptr);
+        if (!next_head) {
+          next_head = node->leftmost_ptr();
+        }
+        auto vend = node->get_version(need_restart);
+        if (need_restart || (vstart != vend)) {
+          goto restart;
+        }
+        node = sibling;
+      }
+      if ((separators.size() >= min_count) || (level_head->level == 1)) {
+        break;
+      }
+      level_head = next_head;
+    }
+    std::sort(separators.begin(), separators.end(), key_less);
+    separators.erase(std::unique(separators.begin(), separators.end(),
+                                 key_equal),
+                     separators.end());
+    return separators;
+  }
+
+  /**
+   * @brief run @p fn (thread id) on @p num_threads threads and wait for them.
+   */
+  template <typename F>
+  static void run_threads(int num_threads, F&& fn) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; i++) {
+      threads.emplace_back(fn, i);
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
+  /**
+   * @brief traverse tree from root to leaf by @p key
+   * @param key lookup key
+   * @param[out] stacks traversed nodes ptr, nullptr for read only operations
+   * which do not need the path
+   * @param[out] leaf_version_start leafnode's read lock version
+   * @param[out] missing if not nullptr, a leaf whose page is evicted is not
+   * faulted in, it is stored here and nullptr is returned
+   * @return traversed leaf node
+   */
+  leaf_t* traverse_to_leafnode(
+      key_t key, NodeStack<internal_t>* stacks,
+      uint64_t* leaf_version_start, Node** missing = nullptr) {
+  restart:
+    auto cur = load_root();
+    if (stacks) {
+      stacks->clear();
+    }
+
+    bool need_restart = false;
+    if (missing && !BufferManager::is_resident(cur)) {
+      *missing = cur;
+      return nullptr;
+    }
+    auto cur_vstart = cur->try_readlock(need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+    // node of the upper level cur was reached from, nullptr at root level
+    internal_t* parent = nullptr;
+    uint64_t parent_vstart = 0;
+
+    // tree traversal
+    while (cur->level != 0) {
+      // Find the next node cotains key, may be next level node or next sibling
+      // node.
+      auto child = static_cast<internal_t*>(cur)->scan_node(key);
+      if (missing && !BufferManager::is_resident(child)) {
+        // child was read from a consistent version of cur
+        auto cur_vend = cur->get_version(need_restart);
+        if (need_restart || (cur_vstart != cur_vend)) {
+          goto restart;
+        }
+        *missing = child;
+        return nullptr;
+      }
+      auto child_vstart = child->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+
+      // When execute cur->scan_node(), cur may be changed by other thread.
+      // So if strat_version != cur_version, means cur is changed,
+      //    if need_restart == true, means cur is changing.
+      auto cur_vend = cur->get_version(need_restart);
+      if (need_restart || (cur_vstart != cur_vend)) {
+        goto restart;
+      }
+
+      // If cur->scan_node() return sibling node, continue current level,
+      // else go to next level.
+      if (child != static_cast<internal_t*>(cur)->sibling_ptr) {
+        if (stacks) {
+          stacks->push_back(static_cast<internal_t*>(cur));
+        }
+        parent = static_cast<internal_t*>(cur);
+        parent_vstart = cur_vstart;
+      } else if (complete_split(parent, parent_vstart, cur, child)) {
+        goto restart;
+      }
+
+      cur = child;
+      cur_vstart = child_vstart;
+    }
+
+    // get leaf node
+    auto leaf = static_cast<leaf_t*>(cur);
+    auto leaf_vstart = cur_vstart;
+    while (leaf->sibling_ptr && Compare::less(leaf->high_key, key)) {
+      auto sibling = static_cast<leaf_t*>(leaf->sibling_ptr);
+      if (missing && !BufferManager::is_resident(sibling)) {
+        auto leaf_vend = leaf->get_version(need_restart);
+        if (need_restart || (leaf_vstart != leaf_vend)) {
+          goto restart;
+        }
+        *missing = sibling;
+        return nullptr;
+      }
       auto sibling_vstart = sibling->try_readlock(need_restart);
       if (need_restart) {
         goto restart;
@@ -222,6 +2394,9 @@ class BLinkTree {
       if (need_restart || (leaf_vstart != leaf_vend)) {
         goto restart;
       }
+      if (complete_split(parent, parent_vstart, leaf, sibling)) {
+        goto restart;
+      }
 
       leaf = sibling;
       leaf_vstart = sibling_vstart;
@@ -231,6 +2406,57 @@ class BLinkTree {
     return leaf;
   }
 
+  /**
+   * @brief With PERSISTENT_TREE, link @p right , reached from @p left through
+   *        its sibling ptr, to the parent level if it is the right half of a
+   *        split that a crashed process left without a parent entry. Only
+   *        nodes of an earlier generation of the heap file qualify, so the
+   *        check costs nothing in a tree created by the current process.
+   *        Subtree counts of operations in flight at the crash may be off
+   *        with ORDER_STATS.
+   *        The caller holds no write lock.
+   * @param parent node of the upper level @p left was reached from, read
+   * with version @p parent_vstart , nullptr if @p left is at root level
+   * @return true if the parent level was changed, so the caller restarts
+   */
+  bool complete_split(internal_t* parent, uint64_t parent_vstart,
+                      Node* left, Node* right) {
+    if (!right->from_earlier_generation()) {
+      return false;
+    }
+    if (parent) {
+      if ((parent->child_pos(left) == -1) ||
+          (parent->child_pos(right) != -1)) {
+        return false;
+      }
+      // the last child of parent links the first child of the next parent
+      if (parent->sibling_ptr &&
+          !Compare::less(high_key_of(left), parent->high_key)) {
+        return false;
+      }
+      bool need_restart = false;
+      auto parent_vend = parent->get_version(need_restart);
+      if (need_restart || (parent_vstart != parent_vend)) {
+        return false;
+      }
+    } else if (left != load_root()) {
+      return false;
+    }
+
+    if (!left->try_writelock()) {
+      return false;
+    }
+    // completed by another thread, or unlinked by a merge meanwhile
+    if ((left->sibling_ptr != right) || !right->from_earlier_generation()) {
+      left->write_unlock();
+      return true;
+    }
+    right->renew_generation();
+    NodeStack<internal_t> stack;
+    insert_into_parent(stack, left, high_key_of(left), right, 0);
+    return true;
+  }
+
   /**
    * @brief The @p leaf node is full, so it needs to be split recursively.
    *        The caller needs to ensure that the current thread holds the write
@@ -242,49 +2468,420 @@ class BLinkTree {
    * @param value the value need to be inserted into leaf
    */
   void backtrack_insertion_split_key(
-      const std::vector<InternalNode<key_t>*>& stack, LeafNode<key_t>* leaf,
+      const NodeStack<internal_t>& stack, leaf_t* leaf,
       key_t key, uint64_t value) {
     // leaf node is full, need split
     key_t split_key;
     auto new_leaf = leaf->split(split_key);
-    if (key <= split_key) {
+    if (!Compare::less(split_key, key)) {
       leaf->insert(key, value);
     } else {
       new_leaf->insert(key, value);
     }
+    if (!new_leaf->sibling_ptr) {
+      store_rightmost(new_leaf);
+    }
+
+    insert_into_parent(stack, leaf, split_key, new_leaf, 1);
+    new_leaf->publish();
+  }
+
+  /**
+   * Copy of a node, see read_node().
+   */
+  struct NodeCopy {
+    alignas(internal_t) alignas(leaf_t) unsigned char
+        bytes[std::max(sizeof(internal_t), sizeof(leaf_t))];
+
+    Node* node() { return reinterpret_cast<Node*>(bytes); }
+
+    internal_t* internal() { return reinterpret_cast<internal_t*>(bytes); }
+
+    leaf_t* leaf() { return reinterpret_cast<leaf_t*>(bytes); }
+  };
+
+  /**
+   * @brief copy @p node into @p copy between two equal versions of it, so
+   *        the copy never holds the half done change of a writer.
+   * @param[in,out] retries incremented for every repeated read
+   * @return false if @p node is obsolete, it was merged into its left sibling
+   */
+  static bool read_node(Node* node, NodeCopy& copy, uint64_t& retries) {
+    while (true) {
+      bool need_restart = false;
+      auto vstart = node->try_readlock(need_restart);
+      if (!need_restart) {
+        auto size = node->level ? sizeof(internal_t) : sizeof(leaf_t);
+        memcpy((void*)copy.bytes, (void*)node, size);
+        auto vend = node->get_version(need_restart);
+        if (!need_restart && (vstart == vend)) {
+          return true;
+        }
+      } else if (node->is_obsolete(node->lock.load())) {
+        return false;
+      }
+      retries++;
+    }
+  }
+
+  /**
+   * @brief verify() the nodes of @p level , from its leftmost node @p head
+   *        along the sibling chain. In quiescent mode the children of each
+   *        node are matched against the chain of the level below, starting at
+   *        @p child_head , nodes of that chain missing from every parent are
+   *        counted as unlinked.
+   */
+  void verify_level(Node* head, uint32_t level, Node* child_head,
+                    bool concurrent, bool unique_keys, VerifyReport& report) {
+    auto where = "level " + std::to_string(level) + ": ";
+    auto fail = [&report, &where](const char* error) {
+      report.ok = false;
+      report.error = where + error;
+    };
+    // whether a may come before b in key order
+    auto before = [unique_keys](const key_t& a, const key_t& b) {
+      return unique_keys ? Compare::less(a, b) : !Compare::less(b, a);
+    };
+    int capacity = level ? internal_t::cardinality - 1 : leaf_t::cardinality;
+    NodeCopy copy, child;
+
+  restart:
+    uint64_t nodes = 0, entries = 0, keys = 0, duplicates = 0, unlinked = 0;
+    bool has_prev = false;
+    key_t prev_high{};  // high key of the left sibling
+    key_t last_key{};   // last key of the previous non-empty leaf
+    bool has_last_key = false;
+
+    // quiescent mode: next node of the level below expected as a child, and
+    // the child before it whose high key must equal its separator
+    Node* below = child_head;
+    bool pending = false;
+    key_t pending_high{}, below_high{};
+    uint64_t pending_count = 0, below_count = 0;
+    // consume the node of the level below that no parent refers to
+    auto skip_unlinked = [&]() {
+      if (!read_node(below, child, report.retries)) {
+        fail("obsolete node in the sibling chain of the level below");
+        return false;
+      }
+      unlinked++;
+      if (!PERSISTENT_TREE) {
+        fail("node below reachable from its left sibling only");
+        return false;
+      }
+      below_high = high_key_of(child.node());
+      below_count += total_count_of(child.node());
+      below = child.node()->sibling_ptr;
+      return true;
+    };
+    auto close_pending = [&]() {
+      if (pending && !Compare::equal(below_high, pending_high)) {
+        fail("separator differs from the high key of its child");
+        return false;
+      }
+      if (ORDER_STATS && pending && (below_count != pending_count)) {
+        fail("subtree count differs from the keys of its child");
+        return false;
+      }
+      pending = false;
+      return true;
+    };
+
+    for (Node* cur = head; cur;) {
+      if (!read_node(cur, copy, report.retries)) {
+        if (concurrent) {
+          report.retries++;
+          goto restart;
+        }
+        fail("obsolete node in the sibling chain");
+        return;
+      }
+      auto node = copy.node();
+      int cnt = node->get_cnt();
+      if (node->level != level) {
+        fail("node of another level in the sibling chain");
+        return;
+      }
+      if ((cnt < 0) || (cnt > capacity)) {
+        fail("entry count out of range");
+        return;
+      }
+      if (!concurrent && !PERSISTENT_TREE && (cur == head) &&
+          (level == report.height) && node->sibling_ptr) {
+        fail("root has a right sibling");
+        return;
+      }
+
+      auto key_at = [&copy, level](int pos) {
+        return level ? copy.internal()->key_at(pos) : copy.leaf()->key_at(pos);
+      };
+      auto high_key = high_key_of(node);
+      for (int i = 0; i < cnt; i++) {
+        auto key = key_at(i);
+        if (i && Compare::less(key, key_at(i - 1))) {
+          fail("keys not sorted");
+          return;
+        }
+        if (i && unique_keys && Compare::equal(key, key_at(i - 1))) {
+          fail("duplicate key");
+          return;
+        }
+        if (Compare::less(high_key, key)) {
+          fail("key greater than the high key of its node");
+          return;
+        }
+      }
+      if (has_prev && cnt && !before(prev_high, key_at(0))) {
+        fail("key not greater than the high key of the left sibling");
+        return;
+      }
+      if (has_prev && !before(prev_high, high_key)) {
+        fail("high keys not increasing along the sibling chain");
+        return;
+      }
+      if (!level) {
+        for (int i = 0; i < cnt; i++) {
+          auto prior = i ? key_at(i - 1) : last_key;
+          duplicates += (i || has_last_key) && Compare::equal(prior, key_at(i));
+        }
+        if (cnt) {
+          last_key = key_at(cnt - 1);
+          has_last_key = true;
+        }
+        if (duplicates && unique_keys) {
+          fail("duplicate key");
+          return;
+        }
+      }
+
+      // children of an internal node
+      for (int i = 0; level && (i <= cnt); i++) {
+        auto child_ptr = copy.internal()->child_at(i);
+        if (concurrent) {
+          // a child merged away meanwhile is skipped
+          if (read_node(child_ptr, child, report.retries)) {
+            if (child.node()->level != level - 1) {
+              fail("child of another level than the level below");
+              return;
+            }
+            if (i && child.node()->get_cnt() &&
+                !before(key_at(i - 1), child.node()->level
+                                           ? child.internal()->key_at(0)
+                                           : child.leaf()->key_at(0))) {
+              fail("child key not greater than the separator on its left");
+              return;
+            }
+          }
+          continue;
+        }
+
+        while (below != child_ptr) {
+          if (!below) {
+            fail("child missing from the sibling chain of the level below");
+            return;
+          }
+          if (!skip_unlinked()) {
+            return;
+          }
+        }
+        if (!close_pending()) {
+          return;
+        }
+        if (!read_node(child_ptr, child, report.retries)) {
+          fail("obsolete child");
+          return;
+        }
+        if (child.node()->level != level - 1) {
+          fail("child of another level than the level below");
+          return;
+        }
+        // the last child of the rightmost node has no upper bound
+        pending = (i < cnt) || node->sibling_ptr;
+        pending_high = (i < cnt) ? key_at(i) : high_key;
+        if constexpr (ORDER_STATS) {
+          pending_count = copy.internal()->count_at(i);
+        }
+        below_high = high_key_of(child.node());
+        below_count = total_count_of(child.node());
+        below = child.node()->sibling_ptr;
+      }
+
+      nodes++;
+      entries += level ? cnt + 1 : cnt;
+      keys += level ? 0 : cnt;
+      has_prev = true;
+      prev_high = high_key;
+      cur = node->sibling_ptr;
+    }
+
+    if (level && !concurrent) {
+      while (below) {
+        if (!skip_unlinked()) {
+          return;
+        }
+      }
+      if (!close_pending()) {
+        return;
+      }
+    }
+
+    report.nodes[level] = nodes;
+    report.entries[level] = entries;
+    report.fill[level] =
+        nodes ? entries / ((double)nodes * (capacity + (level ? 1 : 0))) : 0.0;
+    report.num_keys += keys;
+    report.duplicate_keys += duplicates;
+    report.unlinked_nodes += unlinked;
+  }
+
+  /**
+   * @brief stats() of the nodes of @p level , from its leftmost node @p head
+   *        along the sibling chain. A node merged away meanwhile restarts the
+   *        level.
+   * @param referenced children of the level above, nullptr at root level
+   * @param[out] children children of the nodes of this level
+   */
+  void stats_level(Node* head, uint32_t level,
+                   const std::unordered_set<Node*>* referenced,
+                   std::unordered_set<Node*>& children, TreeStats& stats) {
+    double capacity = level ? internal_t::cardinality : leaf_t::cardinality;
+    auto& result = stats.levels[level];
+    NodeCopy copy;
+    std::vector<double> fills;
+
+  restart:
+    result = LevelStats();
+    fills.clear();
+    children.clear();
+    uint64_t chain = 0;
+    for (Node* cur = head; cur;) {
+      if (!read_node(cur, copy, stats.retries)) {
+        stats.retries++;
+        goto restart;
+      }
+      auto node = copy.node();
+      int cnt = node->get_cnt();
+      uint64_t entries = level ? cnt + 1 : cnt;
+      for (int i = 0; level && (i <= cnt); i++) {
+        children.insert(copy.internal()->child_at(i));
+      }
+
+      if (!referenced || referenced->count(cur)) {
+        chain = 1;
+      } else {
+        result.unlinked++;
+        chain++;
+      }
+      result.max_chain = std::max(result.max_chain, chain);
+      result.nodes++;
+      result.entries += entries;
+      result.bytes += node_bytes(level);
+      fills.push_back(entries / capacity);
+      cur = node->sibling_ptr;
+    }
+
+    if (!fills.empty()) {
+      std::sort(fills.begin(), fills.end());
+      auto percentile = [&fills](double p) {
+        return fills[std::min<size_t>(fills.size() * p, fills.size() - 1)];
+      };
+      result.fill = result.entries / (capacity * result.nodes);
+      result.fill_p10 = percentile(0.1);
+      result.fill_p50 = percentile(0.5);
+      result.fill_p90 = percentile(0.9);
+    }
+  }
+
+  /**
+   * @brief bytes allocated for a node of @p level : a whole page in the heap
+   *        file or, for leaves, in the buffer pool.
+   */
+  static constexpr size_t node_bytes(uint32_t level) {
+    if (PERSISTENT_TREE) {
+      return PAGE_SIZE;
+    }
+    if (level) {
+      return sizeof(internal_t);
+    }
+    return BUFFER_MANAGER ? BUFFER_PAGE_SIZE : sizeof(leaf_t);
+  }
+
+  /**
+   * @brief key order of the tree, for std algorithms
+   */
+  static bool key_less(const key_t& a, const key_t& b) {
+    return Compare::less(a, b);
+  }
+
+  static bool key_equal(const key_t& a, const key_t& b) {
+    return Compare::equal(a, b);
+  }
+
+  /**
+   * @brief high key of @p node , which may be a leaf or an internal node
+   */
+  static key_t high_key_of(Node* node) {
+    if (node->level) {
+      return static_cast<internal_t*>(node)->high_key;
+    }
+    return static_cast<leaf_t*>(node)->high_key;
+  }
 
-    // current leaf node is root
+  /**
+   * @brief Insert @p split_key and @p right_node , which has been split from
+   *        @p left_node , into the parent level, and split parents
+   *        recursively when they are full.
+   *        The caller needs to hold the write lock of @p left_node , it is
+   *        released once the parent node is write locked.
+   * @param stack traversed nodes ptr of @p left_node
+   * @param left_node  splitted left node
+   * @param split_key  high key of @p left_node
+   * @param right_node splitted right node
+   * @param delta keys added below by the current operation, not yet counted
+   * in the parent level (used with ORDER_STATS)
+   */
+  void insert_into_parent(const NodeStack<internal_t>& stack,
+                          Node* left_node, key_t split_key, Node* right_node,
+                          int64_t delta) {
+    // left node is root
     if (stack.empty()) {
       // root node not changed
-      if (leaf == root) {
-        auto new_root =
-            new InternalNode<key_t>(split_key, leaf, new_leaf, nullptr,
-                                    leaf->level + 1, new_leaf->high_key);
-        root = static_cast<Node*>(new_root);
-        leaf->write_unlock();
+      if (left_node == load_root()) {
+        auto new_root = new internal_t(
+            split_key, left_node, right_node, nullptr, left_node->level + 1,
+            high_key_of(right_node));
+        init_root_count(new_root, left_node, right_node);
+        // the split is durable before the root refers to both halves
+        right_node->flush();
+        left_node->flush();
+        set_root(new_root);
+        left_node->write_unlock();
       } else {  // other thread changed the root
-        update_splitted_root(split_key, new_leaf, leaf);
+        update_splitted_root(split_key, right_node, left_node, delta);
         return;
       }
-    } else {  // current leaf node is not root
+    } else {  // left node is not root
       bool need_restart = false;
       int stack_idx = stack.size() - 1;
 
       auto parent = stack[stack_idx];
-      auto left_node = static_cast<Node*>(leaf);
-      auto right_node = static_cast<Node*>(new_leaf);
 
       // backtrack internal node split
       while (stack_idx > -1) {
         parent = stack[stack_idx];
       parent_restart:
         need_restart = false;
+        // merged into its left sibling by remove_range(), search from root
+        if (parent->is_obsolete(parent->lock.load())) {
+          update_splitted_root(split_key, right_node, left_node, delta);
+          return;
+        }
         auto parent_vstart = parent->try_readlock(need_restart);
         if (need_restart) {
           goto parent_restart;
         }
 
-        while (parent->sibling_ptr && (parent->high_key < split_key)) {
+        while (parent_is_right_of(parent, split_key, left_node)) {
           auto p_sibling = parent->sibling_ptr;
           auto p_sibling_vstart = p_sibling->try_readlock(need_restart);
           if (need_restart) {
@@ -296,7 +2893,7 @@ class BLinkTree {
             goto parent_restart;
           }
 
-          parent = static_cast<InternalNode<key_t>*>(p_sibling);
+          parent = static_cast<internal_t*>(p_sibling);
           parent_vstart = p_sibling_vstart;
         }
 
@@ -305,22 +2902,31 @@ class BLinkTree {
           goto parent_restart;
         }
 
+        auto left_total = total_count_of(left_node);
+        // left node links right node once unlocked
+        right_node->flush();
         left_node->write_unlock();
 
         // normal insert
         if (!parent->is_full()) {
-          parent->insert(split_key, right_node);
-          parent->write_unlock();
+          auto pos = parent->insert(split_key, right_node, left_node);
+          split_count(parent, pos, left_total, delta);
+          write_unlock_counted(&stack, parent, split_key, delta);
           return;
         }
 
         // internal node split
         key_t insert_key = split_key;
         auto new_parent = parent->split(split_key);
-        if (insert_key < split_key) {
-          parent->insert(insert_key, right_node);
+        // with duplicate keys, the half holding left node takes right node
+        if (Compare::less(insert_key, split_key) ||
+            (Compare::equal(insert_key, split_key) &&
+             (parent->child_pos(left_node) != -1))) {
+          auto pos = parent->insert(insert_key, right_node, left_node);
+          split_count(parent, pos, left_total, delta);
         } else {
-          new_parent->insert(insert_key, right_node);
+          auto pos = new_parent->insert(insert_key, right_node, left_node);
+          split_count(new_parent, pos, left_total, delta);
         }
 
         left_node = static_cast<Node*>(parent);
@@ -329,15 +2935,18 @@ class BLinkTree {
           insert_key = split_key;
           parent = stack[--stack_idx];
         } else {
-          if (parent == root) {
-            auto new_root = new InternalNode<key_t>(
+          if (parent == load_root()) {
+            auto new_root = new internal_t(
                 split_key, left_node, right_node, nullptr, parent->level + 1,
                 new_parent->high_key);
-            root = static_cast<Node*>(new_root);
+            init_root_count(new_root, left_node, right_node);
+            right_node->flush();
+            left_node->flush();
+            set_root(new_root);
             parent->write_unlock();
             return;
           } else {
-            update_splitted_root(split_key, right_node, left_node);
+            update_splitted_root(split_key, right_node, left_node, delta);
             return;
           }
         }
@@ -346,14 +2955,233 @@ class BLinkTree {
   }
 
   /**
-   * @brief this function is called when root has been split by another threads
+   * @brief whether the parent of @p child , reached for @p key , lies right of
+   *        @p node on the parent level. Duplicate keys give several nodes a
+   *        high key equal to @p key , among them only the children tell; the
+   *        caller holds the write lock of @p child , so it is a child of one.
+   */
+  static bool parent_is_right_of(internal_t* node, key_t key, Node* child) {
+    if (!node->sibling_ptr || Compare::less(key, node->high_key)) {
+      return false;
+    }
+    return Compare::less(node->high_key, key) ||
+           (node->child_pos(child) == -1);
+  }
+
+  /**
+   * @brief keys stored under @p node , only maintained with ORDER_STATS.
+   */
+  static uint64_t total_count_of(Node* node) {
+    if constexpr (ORDER_STATS) {
+      if (node->level) {
+        return static_cast<internal_t*>(node)->total_count();
+      }
+      return node->get_cnt();
+    }
+    return 0;
+  }
+
+  /**
+   * @brief After the split key of a node was inserted at @p pos of @p parent ,
+   *        divide the subtree count of the split node's entry between the
+   *        split node ( @p left_total keys) and the new right node. @p delta
+   *        keys added by the current operation are not counted in @p parent
+   *        yet. Only maintained with ORDER_STATS.
+   */
+  static void split_count(internal_t* parent, int pos,
+                          uint64_t left_total, int64_t delta) {
+    if constexpr (ORDER_STATS) {
+      parent->count_at(pos + 1) = parent->count_at(pos) + delta - left_total;
+      parent->count_at(pos) = left_total;
+    }
+  }
+
+  /**
+   * @brief set subtree counts of a new root over @p left and @p right .
+   */
+  static void init_root_count(internal_t* new_root, Node* left,
+                              Node* right) {
+    if constexpr (ORDER_STATS) {
+      new_root->count_at(0) = total_count_of(left);
+      new_root->count_at(1) = total_count_of(right);
+    }
+  }
+
+  /**
+   * @brief Release the write lock of @p node whose subtree gained @p delta
+   *        keys. With ORDER_STATS, @p delta is first added to the subtree
+   *        counts of all ancestors, write locking them bottom up and releasing
+   *        each child once its parent is locked, so counts stay exact.
+   * @param stack traversed nodes ptr of @p node , may be nullptr
+   * @param key a key within the range of @p node
+   */
+  void write_unlock_counted(const NodeStack<internal_t>* stack,
+                            Node* node, key_t key, int64_t delta) {
+    if constexpr (ORDER_STATS) {
+      while (delta) {
+        auto parent = lock_parent(stack, node, key);
+        if (!parent) {
+          break;
+        }
+        parent->count_at(parent->find_child(key, node)) += delta;
+        node->write_unlock();
+        node = parent;
+      }
+    }
+    node->write_unlock();
+  }
+
+  /**
+   * @brief Find and write lock the node of @p level whose range covers
+   *        @p key , searching from root.
+   * @return locked node, nullptr if blinktree is lower than @p level
+   */
+  Node* lock_node_at(key_t key, uint32_t level) {
+  restart:
+    bool need_restart = false;
+    auto cur = load_root();
+    auto cur_vstart = cur->try_readlock(need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+    if (cur->level < level) {
+      return nullptr;
+    }
+
+    while (cur->level != level) {
+      auto child = static_cast<internal_t*>(cur)->scan_node(key);
+      auto child_vstart = child->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+
+      auto cur_vend = cur->get_version(need_restart);
+      if (need_restart || (cur_vstart != cur_vend)) {
+        goto restart;
+      }
+
+      cur = child;
+      cur_vstart = child_vstart;
+    }
+
+    while (cur->sibling_ptr && Compare::less(high_key_of(cur), key)) {
+      auto sibling = cur->sibling_ptr;
+      auto sibling_vstart = sibling->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+
+      auto cur_vend = cur->get_version(need_restart);
+      if (need_restart || (cur_vstart != cur_vend)) {
+        goto restart;
+      }
+
+      cur = sibling;
+      cur_vstart = sibling_vstart;
+    }
+
+    cur->try_upgrade_writelock(cur_vstart, need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+    return cur;
+  }
+
+  /**
+   * @brief Find and write lock the node one level above @p node whose range
+   *        covers @p key . Starts from @p stack when it holds that level,
+   *        otherwise searches from root. The caller holds the write lock of
+   *        @p node .
+   * @return parent node, nullptr if @p node is root
+   */
+  internal_t* lock_parent(const NodeStack<internal_t>* stack,
+                                   Node* node, key_t key) {
+    int stack_idx = stack ? stack->size() - 1 - (int)node->level : -1;
+  restart:
+    if (node == load_root()) {
+      return nullptr;
+    }
+    bool need_restart = false;
+    Node* cur = nullptr;
+    uint64_t cur_vstart = 0;
+
+    if (stack_idx >= 0) {
+      cur = (*stack)[stack_idx];
+      // merged into its left sibling by remove_range()
+      if (cur->is_obsolete(cur->lock.load())) {
+        stack_idx = -1;
+        goto restart;
+      }
+      cur_vstart = cur->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+    } else {
+      // new root is installed before the old one is unlocked, wait for it
+      cur = load_root();
+      if (cur->level <= node->level) {
+        goto restart;
+      }
+      cur_vstart = cur->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+
+      while (cur->level != node->level + 1) {
+        auto child = static_cast<internal_t*>(cur)->scan_node(key);
+        auto child_vstart = child->try_readlock(need_restart);
+        if (need_restart) {
+          goto restart;
+        }
+
+        auto cur_vend = cur->get_version(need_restart);
+        if (need_restart || (cur_vstart != cur_vend)) {
+          goto restart;
+        }
+
+        cur = child;
+        cur_vstart = child_vstart;
+      }
+    }
+
+    auto parent = static_cast<internal_t*>(cur);
+    while (parent_is_right_of(parent, key, node)) {
+      auto sibling = parent->sibling_ptr;
+      auto sibling_vstart = sibling->try_readlock(need_restart);
+      if (need_restart) {
+        goto restart;
+      }
+
+      auto parent_vend = parent->get_version(need_restart);
+      if (need_restart || (cur_vstart != parent_vend)) {
+        goto restart;
+      }
+
+      parent = static_cast<internal_t*>(sibling);
+      cur_vstart = sibling_vstart;
+    }
+
+    parent->try_upgrade_writelock(cur_vstart, need_restart);
+    if (need_restart) {
+      goto restart;
+    }
+    return parent;
+  }
+
+  /**
+   * @brief this function is called when root has been split by another threads,
+   *        or when a node is split without traversal stack (see append()).
+   *        The parent level node is searched from root.
    * @param key   middle key should be insert into root
    * @param value splitted right node
    * @param prev  splitted left node
+   * @param delta keys added below by the current operation, not yet counted
+   * in the parent level (used with ORDER_STATS)
    */
-  void update_splitted_root(key_t key, Node* value, Node* prev) {
+  void update_splitted_root(key_t key, Node* value, Node* prev,
+                            int64_t delta) {
   restart:
-    auto cur = root;
+    auto cur = load_root();
     bool need_restart = false;
 
     auto cur_vstart = cur->try_readlock(need_restart);
@@ -364,7 +3192,7 @@ class BLinkTree {
     // since we need to find the internal node which has been previously the
     // root, we use readlock for traversal
     while (cur->level != prev->level + 1) {
-      auto child = (static_cast<InternalNode<key_t>*>(cur))->scan_node(key);
+      auto child = (static_cast<internal_t*>(cur))->scan_node(key);
       auto child_vstart = child->try_readlock(need_restart);
       if (need_restart) {
         goto restart;
@@ -380,9 +3208,8 @@ class BLinkTree {
     }
 
     // found parent level node
-    while ((static_cast<InternalNode<key_t>*>(cur))->sibling_ptr &&
-           ((static_cast<InternalNode<key_t>*>(cur))->high_key < key)) {
-      auto sibling = (static_cast<InternalNode<key_t>*>(cur))->sibling_ptr;
+    while (parent_is_right_of(static_cast<internal_t*>(cur), key, prev)) {
+      auto sibling = (static_cast<internal_t*>(cur))->sibling_ptr;
       auto sibling_vstart = sibling->try_readlock(need_restart);
       if (need_restart) {
         goto restart;
@@ -393,7 +3220,7 @@ class BLinkTree {
         goto restart;
       }
 
-      cur = static_cast<InternalNode<key_t>*>(sibling);
+      cur = static_cast<internal_t*>(sibling);
       cur_vstart = sibling_vstart;
     }
 
@@ -401,30 +3228,40 @@ class BLinkTree {
     if (need_restart) {
       goto restart;
     }
+    auto prev_total = total_count_of(prev);
+    value->flush();
     prev->write_unlock();
 
-    auto node = static_cast<InternalNode<key_t>*>(cur);
+    auto node = static_cast<internal_t*>(cur);
     if (!node->is_full()) {
-      node->insert(key, value);
-      node->write_unlock();
+      auto pos = node->insert(key, value, prev);
+      split_count(node, pos, prev_total, delta);
+      write_unlock_counted(nullptr, node, key, delta);
       return;
     } else {
       key_t split_key;
       auto new_node = node->split(split_key);
-      if (key <= split_key)
-        node->insert(key, value);
-      else
-        new_node->insert(key, value);
+      if (Compare::less(key, split_key) ||
+          (Compare::equal(key, split_key) && (node->child_pos(prev) != -1))) {
+        auto pos = node->insert(key, value, prev);
+        split_count(node, pos, prev_total, delta);
+      } else {
+        auto pos = new_node->insert(key, value, prev);
+        split_count(new_node, pos, prev_total, delta);
+      }
 
-      if (node == root) {  // if current nodes is root
+      if (node == load_root()) {  // if current nodes is root
         auto new_root =
-            new InternalNode<key_t>(split_key, node, new_node, nullptr,
+            new internal_t(split_key, node, new_node, nullptr,
                                     node->level + 1, new_node->high_key);
-        root = static_cast<Node*>(new_root);
+        init_root_count(new_root, node, new_node);
+        new_node->flush();
+        node->flush();
+        set_root(new_root);
         node->write_unlock();
         return;
       } else {  // other thread has already created a new root
-        update_splitted_root(split_key, new_node, node);
+        update_splitted_root(split_key, new_node, node, delta);
         return;
       }
     }
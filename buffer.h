@@ -0,0 +1,375 @@
+#ifndef BUFFER_H_
+#define BUFFER_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#define BUFFER_PAGE_SIZE (4096)  // bytes of a leaf page in the buffer pool
+#define BUFFER_EVICT_SCAN (256)   // pages visited by one clock sweep at most
+
+namespace BLINK_TREE {
+
+/**
+ * Process wide pool of leaf pages backed by a file, so trees can grow beyond
+ * memory, in the style of vmcache. Leaves live in one reserved range of
+ * virtual memory, page i at offset i * BUFFER_PAGE_SIZE of both the range
+ * and the file, so a Node* stays valid whether its page is resident or not
+ * and no pointer is ever swizzled. A clock sweep evicts unreferenced leaves
+ * when resident pages exceed the budget: the leaf is write locked, written
+ * back if modified since it was read, and its memory is released, which
+ * makes the page read as zeros. The first word of a page is the version lock
+ * of its node, and a resident node never has version 0, so optimistic
+ * readers on an evicted page fail validation and the thread that finds
+ * version 0 reads the page back in before restarting. Resident hits only
+ * pay for the referenced bit. A new node starts at version 0b100 and is not
+ * evicted before Node::publish() or its first write unlock, since its
+ * creator may fill it without holding the lock.
+ */
+class BufferManager {
+ public:
+  /**
+   * @brief create the pool, swapping to the file at @p path . Must be called
+   *        before any tree allocates leaves, leaves allocated before stay on
+   *        the heap. The file is scratch space that is overwritten, so an
+   *        existing non-empty file is refused rather than destroyed.
+   * @param capacity_bytes virtual size of the pool, bounds the leaves of all
+   * trees, further leaves are allocated on the heap
+   * @param budget_bytes memory the resident leaves may take
+   * @return false if the file cannot be created or is not empty
+   */
+  static bool open(const char* path, uint64_t capacity_bytes,
+                   uint64_t budget_bytes) {
+    auto manager = new BufferManager();
+    if (!manager->init(path, capacity_bytes, budget_bytes)) {
+      delete manager;
+      return false;
+    }
+    pool.store(manager);
+    return true;
+  }
+
+  static void* allocate(size_t size) {
+    auto manager = pool.load(std::memory_order_relaxed);
+    if (!manager || (size > BUFFER_PAGE_SIZE)) {
+      return ::operator new(size);
+    }
+    auto ptr = manager->allocate_page();
+    return ptr ? ptr : ::operator new(size);
+  }
+
+  static void release(void* ptr) {
+    auto manager = pool.load(std::memory_order_relaxed);
+    if (!manager || !manager->contains(ptr)) {
+      ::operator delete(ptr);
+      return;
+    }
+    manager->release_page(ptr);
+  }
+
+  /**
+   * @brief mark the page of @p ptr as recently used, if it is pooled.
+   */
+  static void touch(const void* ptr) {
+    auto manager = pool.load(std::memory_order_relaxed);
+    if (manager && manager->contains(ptr)) {
+      auto& page = manager->pages[manager->page_of(ptr)];
+      if (!page.referenced.load(std::memory_order_relaxed)) {
+        page.referenced.store(1, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief read the page of @p ptr back in if it is evicted, called when a
+   *        node reads version 0. Returns at once if the page is resident or
+   *        not pooled, the caller restarts in any case.
+   */
+  static void fault_in(const void* ptr) {
+    auto manager = pool.load(std::memory_order_relaxed);
+    if (manager && manager->contains(ptr)) {
+      manager->load_page(manager->page_of(ptr));
+    }
+  }
+
+  /**
+   * @brief whether the node at @p ptr can be read without a fault, true for
+   *        resident pages and nodes outside the pool.
+   */
+  static bool is_resident(const void* ptr) {
+    auto manager = pool.load(std::memory_order_relaxed);
+    return !manager || !manager->contains(ptr) ||
+           (manager->pages[manager->page_of(ptr)].state.load() == RESIDENT);
+  }
+
+  /**
+   * Read of an evicted page, issued by the caller of start_load().
+   */
+  struct PageRead {
+    int fd;
+    void* buf;
+    uint64_t offset;
+  };
+
+  enum LoadStatus { LOAD_ISSUE = 0, LOAD_RESIDENT, LOAD_BUSY };
+
+  /**
+   * @brief claim the load of the evicted page of @p ptr , so it can be read
+   *        asynchronously and the calling thread need not block in
+   *        fault_in().
+   * @return LOAD_ISSUE if the caller now owns the load and must read @p read
+   *         then call finish_load(), LOAD_RESIDENT if the page can be read,
+   *         LOAD_BUSY if another thread is loading it
+   */
+  static LoadStatus start_load(const void* ptr, PageRead* read) {
+    auto manager = pool.load(std::memory_order_relaxed);
+    if (!manager || !manager->contains(ptr)) {
+      return LOAD_RESIDENT;
+    }
+    auto idx = manager->page_of(ptr);
+    auto status = manager->claim_load(idx);
+    if (status == LOAD_ISSUE) {
+      *read = {manager->fd, manager->page_addr(idx), idx * BUFFER_PAGE_SIZE};
+    }
+    return status;
+  }
+
+  /**
+   * @brief make the page of @p ptr resident once @p done bytes of the read
+   *        returned by start_load() were transferred, a short or failed read
+   *        is completed with pread().
+   */
+  static void finish_load(const void* ptr, int64_t done) {
+    auto manager = pool.load(std::memory_order_relaxed);
+    auto idx = manager->page_of(ptr);
+    manager->read_page(idx, std::max<int64_t>(done, 0));
+    manager->publish_page(idx);
+  }
+
+  /**
+   * @brief bytes of resident pool pages, 0 without a pool.
+   */
+  static uint64_t resident_bytes() {
+    auto manager = pool.load();
+    return manager ? manager->resident.load() * BUFFER_PAGE_SIZE : 0;
+  }
+
+ private:
+  enum PageState : uint8_t { FREE = 0, RESIDENT, EVICTED, LOADING };
+
+  struct Page {
+    std::atomic<uint8_t> state;
+    std::atomic<uint8_t> referenced;  // second chance of the clock sweep
+    uint64_t clean_version;  // version the file copy holds, 0 if none
+    uint64_t evict_version;  // locked version the page was evicted with
+  };
+
+  BufferManager()
+      : base(nullptr),
+        fd(-1),
+        capacity(0),
+        budget(0),
+        next_page(0),
+        resident(0),
+        hand(0) {}
+
+  bool init(const char* path, uint64_t capacity_bytes, uint64_t budget_bytes) {
+    capacity = capacity_bytes / BUFFER_PAGE_SIZE;
+    budget = std::max<uint64_t>(budget_bytes / BUFFER_PAGE_SIZE, 1);
+    fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || (st.st_size != 0)) {
+      ::close(fd);
+      return false;
+    }
+    auto addr = ::mmap(nullptr, capacity * BUFFER_PAGE_SIZE,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    base = static_cast<char*>(addr);
+    pages = std::vector<Page>(capacity);
+    return true;
+  }
+
+  bool contains(const void* ptr) const {
+    auto p = static_cast<const char*>(ptr);
+    return (p >= base) && (p < base + capacity * BUFFER_PAGE_SIZE);
+  }
+
+  uint64_t page_of(const void* ptr) const {
+    return (static_cast<const char*>(ptr) - base) / BUFFER_PAGE_SIZE;
+  }
+
+  char* page_addr(uint64_t idx) const { return base + idx * BUFFER_PAGE_SIZE; }
+
+  std::atomic<uint64_t>* lock_of(uint64_t idx) const {
+    return reinterpret_cast<std::atomic<uint64_t>*>(page_addr(idx));
+  }
+
+  void* allocate_page() {
+    uint64_t idx;
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      if (!free_pages.empty()) {
+        idx = free_pages.back();
+        free_pages.pop_back();
+      } else if (next_page < capacity) {
+        idx = next_page++;
+      } else {
+        return nullptr;
+      }
+      auto& page = pages[idx];
+      page.referenced.store(1);
+      page.clean_version = 0;
+      page.state.store(RESIDENT);
+    }
+    resident.fetch_add(1);
+    evict_if_needed();
+    return page_addr(idx);
+  }
+
+  /**
+   * @brief free a page, its node is retired so no thread accesses it.
+   */
+  void release_page(void* ptr) {
+    auto idx = page_of(ptr);
+    if (pages[idx].state.exchange(FREE) == RESIDENT) {
+      resident.fetch_sub(1);
+    }
+    ::madvise(ptr, BUFFER_PAGE_SIZE, MADV_DONTNEED);
+    std::lock_guard<std::mutex> guard(mutex);
+    free_pages.push_back(idx);
+  }
+
+  void load_page(uint64_t idx) {
+    auto status = claim_load(idx);
+    if (status == LOAD_ISSUE) {
+      read_page(idx, 0);
+      publish_page(idx);
+    } else if (status == LOAD_BUSY) {
+      std::this_thread::yield();
+    }
+  }
+
+  LoadStatus claim_load(uint64_t idx) {
+    auto& page = pages[idx];
+    auto state = page.state.load();
+    if ((state != EVICTED) ||
+        !page.state.compare_exchange_strong(state, LOADING)) {
+      return (state == LOADING) ? LOAD_BUSY : LOAD_RESIDENT;
+    }
+    return LOAD_ISSUE;
+  }
+
+  /**
+   * @brief read the rest of page @p idx from the file, @p done bytes are
+   *        already in place.
+   */
+  void read_page(uint64_t idx, size_t done) {
+    auto addr = page_addr(idx);
+    while (done < BUFFER_PAGE_SIZE) {
+      auto ret = ::pread(fd, addr + done, BUFFER_PAGE_SIZE - done,
+                         idx * BUFFER_PAGE_SIZE + done);
+      if (ret <= 0) {
+        break;
+      }
+      done += ret;
+    }
+  }
+
+  void publish_page(uint64_t idx) {
+    auto& page = pages[idx];
+    // a newer version than any reader saw before the eviction
+    auto version = page.evict_version + 0b10;
+    page.clean_version = version;
+    page.referenced.store(1);
+    lock_of(idx)->store(version);
+    page.state.store(RESIDENT);
+    resident.fetch_add(1);
+    evict_if_needed();
+  }
+
+  /**
+   * @brief sweep the clock over allocated pages until resident pages fit
+   *        the budget. A sweep is bounded, so pinned or locked pages may keep
+   *        the pool above budget for a while rather than stall the caller.
+   */
+  void evict_if_needed() {
+    auto used = next_page.load();
+    uint64_t limit = std::min<uint64_t>(2 * used, BUFFER_EVICT_SCAN);
+    for (uint64_t i = 0; (i < limit) && (resident.load() > budget); i++) {
+      auto idx = hand.fetch_add(1) % used;
+      auto& page = pages[idx];
+      if (page.state.load() != RESIDENT) {
+        continue;
+      }
+      if (page.referenced.load()) {
+        page.referenced.store(0);
+        continue;
+      }
+      evict_page(idx);
+    }
+  }
+
+  void evict_page(uint64_t idx) {
+    auto& page = pages[idx];
+    auto lock = lock_of(idx);
+    uint64_t version = lock->load();
+    // skip nodes under construction, locked or obsolete
+    if ((version <= 0b100) || (version & 0b11) ||
+        !lock->compare_exchange_strong(version, version + 0b10)) {
+      return;
+    }
+    // the lock keeps the page resident, release_page() only frees obsolete
+    // nodes
+    if (version != page.clean_version) {
+      size_t done = 0;
+      while (done < BUFFER_PAGE_SIZE) {
+        auto ret = ::pwrite(fd, page_addr(idx) + done, BUFFER_PAGE_SIZE - done,
+                            idx * BUFFER_PAGE_SIZE + done);
+        if (ret <= 0) {
+          lock->store(version);  // keep the page, it cannot be written
+          return;
+        }
+        done += ret;
+      }
+    }
+    page.evict_version = version + 0b10;
+    ::madvise(page_addr(idx), BUFFER_PAGE_SIZE, MADV_DONTNEED);
+    page.state.store(EVICTED);
+    resident.fetch_sub(1);
+  }
+
+  char* base;  // reserved virtual memory of capacity pages
+  int fd;      // page file
+  uint64_t capacity;
+  uint64_t budget;  // resident pages
+  std::vector<Page> pages;
+  std::mutex mutex;  // protects free_pages and page allocation
+  std::vector<uint64_t> free_pages;
+  std::atomic<uint64_t> next_page;  // pages below were allocated once
+  std::atomic<uint64_t> resident;
+  std::atomic<uint64_t> hand;  // clock position
+
+  static inline std::atomic<BufferManager*> pool{nullptr};
+};  // class BufferManager
+
+}  // namespace BLINK_TREE
+
+#endif  // BUFFER_H_
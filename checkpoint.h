@@ -0,0 +1,312 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <fcntl.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define CHECKPOINT_BLOCK_ENTRIES (4096)  // key-value pairs per block
+#define CHECKPOINT_FORMAT (3)
+#define CHECKPOINT_SCAN_LEAVES (64)  // leaves copied per fuzzy checkpoint step
+
+namespace BLINK_TREE {
+
+/**
+ * Layout of a checkpoint file written by BLinkTree::save(), keys ascending.
+ * | CheckpointHeader | block 0 | block 1 | ... | block n-1 |
+ * Every block but the last holds CHECKPOINT_BLOCK_ENTRIES pairs, so blocks
+ * are located by their index and decoded in parallel.
+ * block: | CheckpointBlock | keys[count] | padding | values[count] |
+ * The keys are zero padded to 8 bytes, so the values are aligned for any
+ * key size.
+ */
+struct CheckpointHeader {
+  char magic[8];  // "BLNKCKPT"
+  uint32_t format;
+  uint32_t key_size;
+  uint64_t num_keys;
+  uint64_t num_blocks;
+  uint64_t wal_seq;  // last write-ahead log record covered by the file
+  uint32_t block_entries;
+  uint32_t crc;  // crc32c of the fields above
+};
+
+struct CheckpointBlock {
+  uint32_t count;
+  uint32_t crc;  // crc32c of keys and values
+};
+
+static constexpr char checkpoint_magic[8] = {'B', 'L', 'N', 'K',
+                                             'C', 'K', 'P', 'T'};
+
+/**
+ * @brief crc32c (Castagnoli) of @p len bytes at @p data , continuing @p crc .
+ */
+inline uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0) {
+  auto p = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+#ifdef __SSE4_2__
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    crc = (uint32_t)_mm_crc32_u64(crc, word);
+  }
+  for (; len; len--) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+#else
+  static const auto table = [] {
+    std::vector<uint32_t> t(256);
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+  for (; len; len--) {
+    crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+#endif
+  return ~crc;
+}
+
+/**
+ * @brief bytes of the padded keys of a block holding @p count pairs.
+ */
+template <typename key_t>
+constexpr size_t checkpoint_keys_size(size_t count) {
+  return (count * sizeof(key_t) + 7) / 8 * 8;
+}
+
+/**
+ * @brief bytes of a block holding @p count pairs.
+ */
+template <typename key_t>
+constexpr size_t checkpoint_block_size(size_t count) {
+  return sizeof(CheckpointBlock) + checkpoint_keys_size<key_t>(count) +
+         count * sizeof(uint64_t);
+}
+
+/**
+ * @brief write @p len bytes to @p fd , retrying short writes.
+ */
+inline bool write_all(int fd, const void* data, size_t len) {
+  auto p = static_cast<const char*>(data);
+  while (len) {
+    auto ret = ::write(fd, p, len);
+    if (ret <= 0) {
+      return false;
+    }
+    p += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+/**
+ * Streams sorted key-value pairs into a checkpoint file. The file is written
+ * under a temporary name and renamed over @p path by finish(), so an existing
+ * checkpoint is only replaced by a complete one.
+ */
+template <typename key_t>
+class CheckpointWriter {
+ public:
+  CheckpointWriter() : fd(-1), num_keys(0), num_blocks(0), cnt(0) {}
+
+  ~CheckpointWriter() {
+    if (fd >= 0) {
+      ::close(fd);
+      ::unlink(tmp_path.c_str());
+    }
+  }
+
+  bool open(const char* _path) {
+    path = _path;
+    tmp_path = path + ".tmp";
+    fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    // header is written last, once the number of keys is known
+    CheckpointHeader header = {};
+    return write_all(fd, &header, sizeof(header));
+  }
+
+  bool append(key_t key, uint64_t value) {
+    keys[cnt] = key;
+    values[cnt] = value;
+    if (++cnt == CHECKPOINT_BLOCK_ENTRIES) {
+      return flush_block();
+    }
+    return true;
+  }
+
+  /**
+   * @brief write the last block and the header, and make the file durable.
+   * @param wal_seq sequence number of the last log record the file covers
+   */
+  bool finish(uint64_t wal_seq = 0) {
+    if (cnt && !flush_block()) {
+      return false;
+    }
+
+    CheckpointHeader header = {};
+    memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.format = CHECKPOINT_FORMAT;
+    header.key_size = sizeof(key_t);
+    header.num_keys = num_keys;
+    header.num_blocks = num_blocks;
+    header.wal_seq = wal_seq;
+    header.block_entries = CHECKPOINT_BLOCK_ENTRIES;
+    header.crc = crc32c(&header, offsetof(CheckpointHeader, crc));
+    if ((::pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) ||
+        (::fsync(fd) != 0)) {
+      return false;
+    }
+    ::close(fd);
+    fd = -1;
+    return ::rename(tmp_path.c_str(), path.c_str()) == 0;
+  }
+
+ private:
+  bool flush_block() {
+    static const char padding[8] = {};
+    CheckpointBlock block;
+    block.count = cnt;
+    block.crc = crc32c(keys, sizeof(key_t) * cnt);
+    block.crc = crc32c(values, sizeof(uint64_t) * cnt, block.crc);
+    if (!write_all(fd, &block, sizeof(block)) ||
+        !write_all(fd, keys, sizeof(key_t) * cnt) ||
+        !write_all(fd, padding,
+                   checkpoint_keys_size<key_t>(cnt) - sizeof(key_t) * cnt) ||
+        !write_all(fd, values, sizeof(uint64_t) * cnt)) {
+      return false;
+    }
+    num_keys += cnt;
+    num_blocks++;
+    cnt = 0;
+    return true;
+  }
+
+  int fd;
+  std::string path;
+  std::string tmp_path;
+  uint64_t num_keys;
+  uint64_t num_blocks;
+  uint32_t cnt;  // pairs in current block
+  key_t keys[CHECKPOINT_BLOCK_ENTRIES];
+  uint64_t values[CHECKPOINT_BLOCK_ENTRIES];
+};  // class CheckpointWriter
+
+/**
+ * Read only mapping of a checkpoint file, with its header and blocks
+ * validated against the file size.
+ */
+template <typename key_t>
+class CheckpointReader {
+ public:
+  CheckpointReader() : data(nullptr), size(0), header(nullptr) {}
+
+  ~CheckpointReader() {
+    if (data) {
+      ::munmap(data, size);
+    }
+  }
+
+  bool open(const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(*header))) {
+      ::close(fd);
+      return false;
+    }
+    size = st.st_size;
+    auto addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    data = static_cast<char*>(addr);
+    ::madvise(data, size, MADV_SEQUENTIAL);
+    ::madvise(data, size, MADV_WILLNEED);
+
+    header = reinterpret_cast<const CheckpointHeader*>(data);
+    if (memcmp(header->magic, checkpoint_magic, sizeof(header->magic)) ||
+        (header->format != CHECKPOINT_FORMAT) ||
+        (header->key_size != sizeof(key_t)) ||
+        (header->block_entries != CHECKPOINT_BLOCK_ENTRIES) ||
+        (header->crc != crc32c(header, offsetof(CheckpointHeader, crc)))) {
+      return false;
+    }
+
+    uint64_t full = header->num_keys / CHECKPOINT_BLOCK_ENTRIES;
+    uint64_t last = header->num_keys % CHECKPOINT_BLOCK_ENTRIES;
+    return (header->num_blocks == full + (last != 0)) &&
+           (size == sizeof(*header) +
+                        full * checkpoint_block_size<key_t>(
+                                   CHECKPOINT_BLOCK_ENTRIES) +
+                        (last ? checkpoint_block_size<key_t>(last) : 0));
+  }
+
+  uint64_t num_keys() const { return header->num_keys; }
+
+  uint64_t num_blocks() const { return header->num_blocks; }
+
+  uint64_t wal_seq() const { return header->wal_seq; }
+
+  /**
+   * @brief check the count and checksum of block @p idx .
+   */
+  bool verify_block(uint64_t idx) const {
+    auto block = block_at(idx);
+    uint64_t expected =
+        std::min<uint64_t>(CHECKPOINT_BLOCK_ENTRIES,
+                           header->num_keys - idx * CHECKPOINT_BLOCK_ENTRIES);
+    if (block->count != expected) {
+      return false;
+    }
+    auto crc = crc32c(keys_of(idx), sizeof(key_t) * block->count);
+    crc = crc32c(values_of(idx), sizeof(uint64_t) * block->count, crc);
+    return crc == block->crc;
+  }
+
+  const key_t* keys_of(uint64_t idx) const {
+    return reinterpret_cast<const key_t*>(block_at(idx) + 1);
+  }
+
+  const uint64_t* values_of(uint64_t idx) const {
+    return reinterpret_cast<const uint64_t*>(
+        reinterpret_cast<const char*>(keys_of(idx)) +
+        checkpoint_keys_size<key_t>(block_at(idx)->count));
+  }
+
+ private:
+  const CheckpointBlock* block_at(uint64_t idx) const {
+    return reinterpret_cast<const CheckpointBlock*>(
+        data + sizeof(*header) +
+        idx * checkpoint_block_size<key_t>(CHECKPOINT_BLOCK_ENTRIES));
+  }
+
+  char* data;
+  size_t size;
+  const CheckpointHeader* header;
+};  // class CheckpointReader
+
+}  // namespace BLINK_TREE
+
+#endif  // CHECKPOINT_H_
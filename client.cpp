@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "rpc.h"
+
+using namespace BLINK_TREE;
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Open a connection to the server listening on @p path .
+ * @return socket, -1 on failure
+ */
+int connect_to(const char* path) {
+  sockaddr_un addr;
+  if (!rpc_address(path, &addr)) {
+    return -1;
+  }
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((fd >= 0) && (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0)) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Drive one connection: keep up to @p depth requests in flight until
+ *        @p num requests got their response. Lookups (@p read_percent of the
+ *        requests) and inserts pick keys in [1, @p key_range ], inserts store
+ *        the key as value, so a found value must equal its key.
+ * @param[out] latencies nanoseconds from sending each request to its
+ * response
+ * @return number of wrong lookup results, -1 if the connection failed
+ */
+int64_t run_connection(const char* path, int num, int depth, int read_percent,
+                       uint64_t key_range, uint64_t seed,
+                       std::vector<uint64_t>& latencies) {
+  int fd = connect_to(path);
+  if (fd < 0) {
+    return -1;
+  }
+  std::mt19937_64 rng(seed);
+  std::vector<Clock::time_point> sent(num);
+  std::vector<uint64_t> sent_keys(num);
+  std::vector<uint8_t> sent_ops(num);
+  latencies.resize(num);
+
+  RpcBuffer in, out;
+  int next = 0, done = 0;
+  int64_t wrong = 0;
+  while (done < num) {
+    // fill the window, the requests are written together
+    for (; (next < num) && (next - done < depth); next++) {
+      RpcRequest request;
+      memset(&request, 0, sizeof(request));
+      request.id = next;
+      request.op = ((int)(rng() % 100) < read_percent) ? RPC_LOOKUP
+                                                        : RPC_INSERT;
+      request.key = rng() % key_range + 1;
+      request.arg = request.key;
+      sent_keys[next] = request.key;
+      sent_ops[next] = request.op;
+      sent[next] = Clock::now();
+      out.append(&request, sizeof(request));
+    }
+    while (!out.empty()) {
+      auto ret = ::write(fd, out.data(), out.size());
+      if (ret <= 0) {
+        ::close(fd);
+        return -1;
+      }
+      out.consume(ret);
+    }
+
+    auto dst = in.reserve(64 * 1024);
+    auto ret = ::read(fd, dst, 64 * 1024);
+    in.unreserve(64 * 1024 - std::max<ssize_t>(ret, 0));
+    if (ret <= 0) {
+      ::close(fd);
+      return -1;
+    }
+    auto now = Clock::now();
+    while (in.size() >= sizeof(RpcResponse)) {
+      RpcResponse response;
+      memcpy(&response, in.data(), sizeof(response));
+      auto len = sizeof(response) + response.count * sizeof(uint64_t);
+      if (in.size() < len) {
+        break;
+      }
+      auto id = response.id;
+      latencies[id] =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent[id])
+              .count();
+      if ((sent_ops[id] == RPC_LOOKUP) && (response.status == RPC_OK)) {
+        uint64_t value;
+        memcpy(&value, in.data() + sizeof(response), sizeof(value));
+        wrong += value != sent_keys[id];
+      }
+      in.consume(len);
+      done++;
+    }
+  }
+  ::close(fd);
+  return wrong;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 5) {
+    std::cerr << "Usage: " << argv[0]
+              << " socket_path num_connections requests_per_connection "
+                 "pipeline_depth [read_percent] [key_range]"
+              << std::endl;
+    exit(0);
+  }
+  const char* path = argv[1];
+  int num_conns = atoi(argv[2]);
+  int num = atoi(argv[3]);
+  int depth = std::max(atoi(argv[4]), 1);
+  int read_percent = argc > 5 ? atoi(argv[5]) : 90;
+  uint64_t key_range = argc > 6 ? atoll(argv[6]) : 1000000;
+
+  std::vector<std::vector<uint64_t>> latencies(num_conns);
+  std::vector<int64_t> wrong(num_conns);
+  std::vector<std::thread> threads;
+  const auto start = Clock::now();
+  for (int i = 0; i < num_conns; i++) {
+    threads.emplace_back([&, i] {
+      wrong[i] = run_connection(path, num, depth, read_percent, key_range,
+                                i + 1, latencies[i]);
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  const auto end = Clock::now();
+
+  std::vector<uint64_t> all;
+  int64_t total_wrong = 0;
+  for (int i = 0; i < num_conns; i++) {
+    if (wrong[i] < 0) {
+      std::cerr << "connection " << i << " failed" << std::endl;
+      return 1;
+    }
+    total_wrong += wrong[i];
+    all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+  }
+  std::sort(all.begin(), all.end());
+  auto percentile = [&all](double p) {
+    return all[std::min<size_t>(all.size() * p, all.size() - 1)] / 1000.0;
+  };
+
+  const auto time =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  std::cout << "Requests: " << all.size() << " in " << time / 1000000000.0
+            << " sec" << std::endl;
+  std::cout << "throughput: "
+            << all.size() / (double)time * 1000000000.0 / 1000000
+            << " mops/sec" << std::endl;
+  std::cout << "latency us: p50 " << percentile(0.5) << " p99 "
+            << percentile(0.99) << " p99.9 " << percentile(0.999) << " max "
+            << all.back() / 1000.0 << std::endl;
+  std::cout << "wrong lookups: " << total_wrong << std::endl;
+  return total_wrong ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blinktree.h"
+
+#if !PERSISTENT_TREE
+#error "crash.cpp checks the heap file, build it with -DPERSISTENT_TREE=1"
+#endif
+
+using Key_t = uint64_t;
+
+using namespace BLINK_TREE;
+
+using Model = std::map<Key_t, uint64_t>;
+
+#define BATCH_KEYS (4096)    // keys of one insert_batch(), split many leaves
+#define BATCH_REMOVED (4000)  // leading keys of a batch removed after it
+
+static bool failed = false;
+
+/**
+ * @brief report a failed check of @p what without stopping, so every check
+ *        runs and main() returns non-zero.
+ */
+void check(bool cond, const std::string& what) {
+  if (!cond) {
+    std::cout << "FAILED: " << what << std::endl;
+    failed = true;
+  }
+}
+
+/**
+ * Progress of the writers of a child process, in memory shared with the
+ * parent. An operation is counted once it returned, so it is durable.
+ */
+struct Progress {
+  std::atomic<int> ready;          // the tree is attached
+  std::atomic<uint64_t> inserted;  // keys inserted one by one
+  std::atomic<uint64_t> batches;   // batches inserted by insert_batch()
+  std::atomic<uint64_t> removed;   // batches whose leading keys are removed
+};
+
+/**
+ * @brief @p i th key inserted one by one in round @p round , in random order
+ *        since multiplying by an odd number is a bijection modulo 2^32.
+ */
+Key_t single_key(int round, uint64_t i) {
+  return ((uint64_t)(2 * round + 1) << 40) + ((i * 0x9e3779b1ull) & 0xffffffff);
+}
+
+/**
+ * @brief @p j th key of batch @p batch in round @p round , batches ascend
+ *        so each one lands in the rightmost leaf.
+ */
+Key_t batch_key(int round, uint64_t batch, uint64_t j) {
+  return ((uint64_t)(2 * round + 2) << 40) + batch * BATCH_KEYS + j;
+}
+
+/**
+ * @brief attach to the heap and modify the tree until killed: one thread
+ *        inserts keys one by one, another inserts sorted batches that split
+ *        a leaf into many at once and removes most of each batch again.
+ */
+[[noreturn]] void child(const std::string& path, int round,
+                        Progress* progress) {
+  if (!PersistentHeap::open(path.c_str(), 64ull << 30, true)) {
+    _exit(2);
+  }
+  auto tree = new BLinkTree<Key_t>();
+  progress->ready = 1;
+  std::thread singles([&] {
+    for (uint64_t i = 0;; i++) {
+      auto key = single_key(round, i);
+      tree->insert(key, key);
+      progress->inserted = i + 1;
+    }
+  });
+  std::vector<Key_t> keys(BATCH_KEYS);
+  for (uint64_t batch = 0;; batch++) {
+    for (uint64_t j = 0; j < BATCH_KEYS; j++) {
+      keys[j] = batch_key(round, batch, j);
+    }
+    tree->insert_batch(keys.data(), keys.data(), BATCH_KEYS, true);
+    progress->batches = batch + 1;
+    tree->remove_range(keys[0], keys[BATCH_REMOVED]);
+    progress->removed = batch + 1;
+  }
+}
+
+/**
+ * @brief add the keys of @p round to @p model as far as @p progress reports
+ *        them durable. Keys of the operations in flight when the child was
+ *        killed may or may not be in the tree, they go to @p unsure .
+ */
+void expect(int round, const Progress& progress, Model& model,
+            std::vector<Key_t>& unsure) {
+  for (uint64_t i = 0; i < progress.inserted; i++) {
+    model[single_key(round, i)] = single_key(round, i);
+  }
+  unsure.push_back(single_key(round, progress.inserted));
+  for (uint64_t batch = 0; batch <= progress.batches; batch++) {
+    for (uint64_t j = 0; j < BATCH_KEYS; j++) {
+      auto key = batch_key(round, batch, j);
+      bool in_flight =
+          (batch == progress.batches) ||
+          ((j < BATCH_REMOVED) && (batch == progress.removed));
+      if (in_flight) {
+        unsure.push_back(key);
+      } else if ((j >= BATCH_REMOVED) || (batch >= progress.removed)) {
+        model[key] = key;
+      }
+    }
+  }
+}
+
+/**
+ * @brief whether @p tree holds exactly the pairs of @p model , besides the
+ *        keys of @p unsure , which are added to @p model if found.
+ */
+bool matches(BLinkTree<Key_t>& tree, Model& model,
+             const std::vector<Key_t>& unsure) {
+  for (auto key : unsure) {
+    if (auto value = tree.lookup(key)) {
+      model[key] = value;
+    }
+  }
+  auto report = tree.verify();
+  if (!report.ok) {
+    std::cout << "verify: " << report.error << std::endl;
+    return false;
+  }
+  if (report.num_keys != model.size()) {
+    return false;
+  }
+  for (auto& [key, value] : model) {
+    if (tree.lookup(key) != value) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  std::string path = argc > 1 ? argv[1] : "crash_heap";
+  int rounds = argc > 2 ? atoi(argv[2]) : 4;
+  ::unlink(path.c_str());
+  auto progress = static_cast<Progress*>(
+      mmap(nullptr, sizeof(Progress), PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+  if (progress == MAP_FAILED) {
+    return 1;
+  }
+  std::mt19937_64 rng(42);
+  Model model;
+
+  for (int round = 0; round < rounds; round++) {
+    new (progress) Progress();
+    pid_t pid = fork();
+    if (!pid) {
+      child(path, round, progress);
+    }
+    while (!progress->ready) {
+      int status;
+      if (waitpid(pid, &status, WNOHANG) == pid) {
+        std::cerr << "cannot open " << path << std::endl;
+        return 1;
+      }
+      usleep(1000);
+    }
+    usleep(200000 + rng() % 400000);
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+
+    std::vector<Key_t> unsure;
+    expect(round, *progress, model, unsure);
+    check(PersistentHeap::open(path.c_str(), 64ull << 30, true), "reopen");
+    check(!PersistentHeap::was_clean(), "killed child left the file clean");
+    auto tree = new BLinkTree<Key_t>();
+    check(matches(*tree, model, unsure),
+          "tree after kill, round " + std::to_string(round));
+    // more splits and merges over nodes of the killed process
+    for (int i = 0; i < 20000; i++) {
+      Key_t key = (rng() >> 24) + 1;
+      tree->upsert(key, key);
+      model[key] = key;
+    }
+    auto low = model.lower_bound(rng() >> 24);
+    auto high = std::next(low, std::min<size_t>(std::distance(
+                                                    low, model.end()),
+                                                3000));
+    if (high != model.end()) {
+      tree->remove_range(low->first, high->first);
+      model.erase(low, high);
+    }
+    check(matches(*tree, model, {}),
+          "tree modified after reopen, round " + std::to_string(round));
+    // lookups of all keys moved through every node the kill left unlinked
+    check(!tree->verify().unlinked_nodes,
+          "splits completed after reopen, round " + std::to_string(round));
+    std::cout << "round " << round << ": " << progress->inserted
+              << " single keys, " << progress->batches << " batches, height "
+              << tree->height() << ", keys " << model.size() << std::endl;
+    delete tree;
+    PersistentHeap::close();
+  }
+
+  check(PersistentHeap::open(path.c_str()), "reopen closed file");
+  check(PersistentHeap::was_clean(), "closed file is clean");
+  auto tree = new BLinkTree<Key_t>();
+  check(matches(*tree, model, {}), "tree of closed file");
+  delete tree;
+  PersistentHeap::close();
+  ::unlink(path.c_str());
+
+  std::cout << (failed ? "crash checks failed" : "all crash checks passed")
+            << std::endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,195 @@
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define MAX_THREADS (256)  // upper bound of threads accessing trees at once
+#define RETIRE_BATCH (64)  // pointers a thread retires before publishing them
+#define RECLAIM_THRESHOLD (4096)  // published pointers that trigger reclaim()
+
+namespace BLINK_TREE {
+
+/**
+ * Process wide slot id of the calling thread. The slot is released when the
+ * thread exits, so ids stay below MAX_THREADS as long as no more than
+ * MAX_THREADS threads are alive at once.
+ */
+class ThreadSlot {
+ public:
+  static int id() {
+    static thread_local ThreadSlot slot;
+    return slot.idx;
+  }
+
+ private:
+  ThreadSlot() : idx(0) {
+    while (true) {
+      for (int i = 0; i < MAX_THREADS; i++) {
+        bool expected = false;
+        if (!used[i].load() && used[i].compare_exchange_strong(expected, true)) {
+          idx = i;
+          return;
+        }
+      }
+      // all slots taken, wait for exiting threads
+      std::this_thread::yield();
+    }
+  }
+
+  ~ThreadSlot() { used[idx].store(false); }
+
+  int idx;
+  static inline std::atomic<bool> used[MAX_THREADS];
+};  // class ThreadSlot
+
+/**
+ * Epoch based reclamation of unlinked nodes.
+ * Every operation announces the global epoch it started in, a retired node is
+ * tagged with the epoch it was retired in and freed once every thread still
+ * inside an operation has started in a later epoch, so no optimistic reader
+ * can hold a pointer to it anymore.
+ * A thread collects retired nodes in its slot and publishes RETIRE_BATCH of
+ * them at once, advancing the epoch. Once RECLAIM_THRESHOLD nodes are
+ * published, the next thread leaving its outermost operation reclaims.
+ */
+class EpochManager {
+ public:
+  static constexpr uint64_t idle = UINT64_MAX;
+
+  EpochManager() : global_epoch(1), reclaim_due(false) {
+    for (auto& slot : slots) {
+      slot.epoch.store(idle);
+      slot.depth = 0;
+    }
+  }
+
+  /**
+   * @brief free all retired memory, no thread may be inside an operation.
+   */
+  ~EpochManager() {
+    for (auto& slot : slots) {
+      retired.insert(retired.end(), slot.pending.begin(), slot.pending.end());
+    }
+    for (auto& r : retired) {
+      r.deleter(r.ptr);
+    }
+  }
+
+  /**
+   * @brief announce that the calling thread starts an operation, may be
+   *        nested.
+   */
+  void enter() {
+    auto& slot = slots[ThreadSlot::id()];
+    if (slot.depth++ == 0) {
+      slot.epoch.store(global_epoch.load());
+    }
+  }
+
+  void exit() {
+    auto& slot = slots[ThreadSlot::id()];
+    if (--slot.depth == 0) {
+      slot.epoch.store(idle, std::memory_order_release);
+      // outside of every operation, so no lock of the tree is held
+      if (reclaim_due.load(std::memory_order_relaxed)) {
+        reclaim();
+      }
+    }
+  }
+
+  /**
+   * @brief hand over @p ptr , which is no longer reachable for new
+   *        operations, to be freed by @p deleter once it is safe.
+   */
+  void retire(void* ptr, void (*deleter)(void*)) {
+    auto& slot = slots[ThreadSlot::id()];
+    slot.pending.push_back({ptr, deleter, global_epoch.load()});
+    if (slot.pending.size() >= RETIRE_BATCH) {
+      publish(slot);
+    }
+  }
+
+  /**
+   * @brief free retired memory that no running operation can access,
+   *        including the nodes the calling thread has not published yet.
+   */
+  void reclaim() {
+    auto& slot = slots[ThreadSlot::id()];
+    if (!slot.pending.empty()) {
+      publish(slot);
+    }
+    reclaim_due.store(false, std::memory_order_relaxed);
+    uint64_t min_epoch = idle;
+    for (auto& slot : slots) {
+      min_epoch = std::min(min_epoch, slot.epoch.load());
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    size_t kept = 0;
+    for (auto& r : retired) {
+      if (r.epoch < min_epoch) {
+        r.deleter(r.ptr);
+      } else {
+        retired[kept++] = r;
+      }
+    }
+    retired.resize(kept);
+  }
+
+ private:
+  struct Retired {
+    void* ptr;
+    void (*deleter)(void*);
+    uint64_t epoch;
+  };
+
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> epoch;  // epoch of running operation, or idle
+    uint64_t depth;               // nesting of enter(), owner thread only
+    std::vector<Retired> pending;  // not yet published, owner thread only
+  };
+
+  /**
+   * @brief move the nodes retired by the owner of @p slot to the shared
+   *        list. Operations starting afterwards get a later epoch than them.
+   */
+  void publish(Slot& slot) {
+    global_epoch.fetch_add(1);
+    std::lock_guard<std::mutex> guard(mutex);
+    retired.insert(retired.end(), slot.pending.begin(), slot.pending.end());
+    slot.pending.clear();
+    if (retired.size() >= RECLAIM_THRESHOLD) {
+      reclaim_due.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  std::atomic<uint64_t> global_epoch;
+  std::atomic<bool> reclaim_due;  // set once RECLAIM_THRESHOLD is reached
+  Slot slots[MAX_THREADS];
+  std::mutex mutex;  // protects retired
+  std::vector<Retired> retired;
+};  // class EpochManager
+
+/**
+ * Keeps the calling thread inside an operation of @p EpochManager during its
+ * lifetime.
+ */
+class EpochGuard {
+ public:
+  explicit EpochGuard(EpochManager& _manager) : manager(_manager) {
+    manager.enter();
+  }
+  ~EpochGuard() { manager.exit(); }
+
+ private:
+  EpochManager& manager;
+};  // class EpochGuard
+
+}  // namespace BLINK_TREE
+
+#endif  // EPOCH_H_
@@ -0,0 +1,372 @@
+#ifndef KEY_H_
+#define KEY_H_
+#include <immintrin.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <type_traits>
+
+namespace BLINK_TREE {
+
+/**
+ * Order of keys in a tree, the default uses the operators of key_t. A custom
+ * order is any type with the same two static members, passed as the Compare
+ * parameter of BLinkTree; it is resolved at compile time, so integer keys
+ * keep their plain comparisons.
+ */
+template <typename key_t>
+struct KeyCompare {
+  static bool less(const key_t& a, const key_t& b) { return a < b; }
+
+  static bool equal(const key_t& a, const key_t& b) { return a == b; }
+};
+
+/**
+ * Key order given by the function objects @p Less , e.g. std::greater<>,
+ * and @p Equal . Keys neither less than each other are equal when no
+ * @p Equal is given.
+ */
+template <typename key_t, typename Less, typename Equal = void>
+struct OrderBy {
+  static bool less(const key_t& a, const key_t& b) { return Less{}(a, b); }
+
+  static bool equal(const key_t& a, const key_t& b) {
+    if constexpr (std::is_void_v<Equal>) {
+      return !Less{}(a, b) && !Less{}(b, a);
+    } else {
+      return Equal{}(a, b);
+    }
+  }
+};
+
+/**
+ * Key of two fields ordered by @p first , then by @p second , e.g.
+ * (tenant_id, timestamp). Trivially copyable like the keys stored in
+ * checkpoints and logs.
+ */
+template <typename A, typename B>
+struct CompositeKey {
+  A first;
+  B second;
+
+  friend bool operator<(const CompositeKey& a, const CompositeKey& b) {
+    return (a.first < b.first) ||
+           (!(b.first < a.first) && (a.second < b.second));
+  }
+
+  friend bool operator==(const CompositeKey& a, const CompositeKey& b) {
+    return (a.first == b.first) && (a.second == b.second);
+  }
+};
+
+/**
+ * @brief memcmp() of two @p N byte keys. Bytes are compared 32 or 16 at a
+ *        time, the first differing one is found in the mask of equal bytes.
+ */
+template <size_t N>
+inline int compare_bytes(const uint8_t* a, const uint8_t* b) {
+  size_t i = 0;
+#ifdef __AVX2__
+  for (; i + 32 <= N; i += 32) {
+    auto eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                _mm256_loadu_si256((const __m256i*)(b + i)));
+    uint32_t diff = ~(uint32_t)_mm256_movemask_epi8(eq);
+    if (diff) {
+      i += __builtin_ctz(diff);
+      return int(a[i]) - int(b[i]);
+    }
+  }
+#endif
+#ifdef __SSE2__
+  for (; i + 16 <= N; i += 16) {
+    auto eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+                             _mm_loadu_si128((const __m128i*)(b + i)));
+    uint32_t diff = ~(uint32_t)_mm_movemask_epi8(eq) & 0xffff;
+    if (diff) {
+      i += __builtin_ctz(diff);
+      return int(a[i]) - int(b[i]);
+    }
+  }
+#endif
+  for (; i + 8 <= N; i += 8) {
+    uint64_t x, y;
+    memcpy(&x, a + i, sizeof(x));
+    memcpy(&y, b + i, sizeof(y));
+    if (x != y) {
+      return (__builtin_bswap64(x) < __builtin_bswap64(y)) ? -1 : 1;
+    }
+  }
+  for (; i < N; i++) {
+    if (a[i] != b[i]) {
+      return int(a[i]) - int(b[i]);
+    }
+  }
+  return 0;
+}
+
+/**
+ * Key of @p N bytes ordered by memcmp(), e.g. a string padded with zeros or
+ * the big endian encoding of a wide CompositeKey. Compared with
+ * compare_bytes(), which the compiler unrolls for the given width.
+ */
+template <size_t N>
+struct FixedKey {
+  uint8_t bytes[N];
+
+  /**
+   * @brief the first @p N bytes of @p str , padded with zeros. Order is kept
+   *        for strings without zero bytes that differ in their first @p N
+   *        bytes, longer strings sharing those bytes become equal.
+   */
+  static FixedKey from_string(std::string_view str) {
+    FixedKey key;
+    auto len = (str.size() < N) ? str.size() : N;
+    memcpy(key.bytes, str.data(), len);
+    memset(key.bytes + len, 0, N - len);
+    return key;
+  }
+
+  friend bool operator<(const FixedKey& a, const FixedKey& b) {
+    return compare_bytes<N>(a.bytes, b.bytes) < 0;
+  }
+
+  friend bool operator==(const FixedKey& a, const FixedKey& b) {
+    return memcmp(a.bytes, b.bytes, N) == 0;
+  }
+};
+
+/**
+ * Unsigned 128-bit key, e.g. a UUID or a 16 byte hash. Only 8 byte aligned,
+ * so an entry with a 64-bit value takes 24 bytes and a node holds as many
+ * entries as the width allows.
+ */
+struct Key128 {
+  uint64_t high;
+  uint64_t low;
+
+  /**
+   * @brief key of 16 big endian bytes, ordered like the bytes by memcmp().
+   */
+  static Key128 from_bytes(const uint8_t* bytes) {
+    uint64_t high, low;
+    memcpy(&high, bytes, sizeof(high));
+    memcpy(&low, bytes + sizeof(high), sizeof(low));
+    return {__builtin_bswap64(high), __builtin_bswap64(low)};
+  }
+
+  friend bool operator<(const Key128& a, const Key128& b) {
+    return (a.high < b.high) || ((a.high == b.high) && (a.low < b.low));
+  }
+
+  friend bool operator==(const Key128& a, const Key128& b) {
+    return (a.high == b.high) && (a.low == b.low);
+  }
+};
+
+/**
+ * Order preserving encoding of T: encode() maps a key to code_t, whose
+ * unsigned order (memcmp() order for FixedKey) is the order of T, and
+ * decode() maps it back. Scalar keys use the low width bytes of a uint64_t.
+ */
+template <typename T, typename = void>
+struct KeyCodec;
+
+template <typename T>
+struct KeyCodec<T, std::enable_if_t<std::is_unsigned_v<T>>> {
+  using code_t = uint64_t;
+  static constexpr size_t width = sizeof(T);
+
+  static code_t encode(T key) { return key; }
+
+  static T decode(code_t code) { return code; }
+};
+
+/**
+ * two's complement with the sign bit flipped, negative keys first
+ */
+template <typename T>
+struct KeyCodec<T, std::enable_if_t<std::is_integral_v<T> &&
+                                    std::is_signed_v<T>>> {
+  using code_t = uint64_t;
+  using bits_t = std::make_unsigned_t<T>;
+  static constexpr size_t width = sizeof(T);
+  static constexpr bits_t sign = bits_t(1) << (sizeof(T) * 8 - 1);
+
+  static code_t encode(T key) { return bits_t(key) ^ sign; }
+
+  static T decode(code_t code) { return T(bits_t(code) ^ sign); }
+};
+
+/**
+ * IEEE 754 bits with the sign bit set for positive keys and all bits
+ * flipped for negative keys. -0.0 orders before 0.0, NaNs with the sign bit
+ * clear after infinity.
+ */
+template <typename T>
+struct KeyCodec<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+  static_assert(sizeof(T) <= sizeof(uint64_t), "no wider floating point");
+  using code_t = uint64_t;
+  using bits_t = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+  static constexpr size_t width = sizeof(T);
+  static constexpr bits_t sign = bits_t(1) << (sizeof(T) * 8 - 1);
+
+  static code_t encode(T key) {
+    bits_t bits;
+    memcpy(&bits, &key, sizeof(bits));
+    return (bits & sign) ? bits_t(~bits) : bits_t(bits | sign);
+  }
+
+  static T decode(code_t code) {
+    bits_t bits = (code & sign) ? bits_t(code & ~sign) : bits_t(~code);
+    T key;
+    memcpy(&key, &bits, sizeof(key));
+    return key;
+  }
+};
+
+/**
+ * codes of both fields side by side, @p first in the higher bytes. Pairs of
+ * up to 8 bytes are packed into one uint64_t, wider pairs into the big
+ * endian bytes of a FixedKey.
+ */
+template <typename A, typename B>
+struct KeyCodec<CompositeKey<A, B>> {
+  using first_codec = KeyCodec<A>;
+  using second_codec = KeyCodec<B>;
+  static_assert(std::is_same_v<typename first_codec::code_t, uint64_t> &&
+                    std::is_same_v<typename second_codec::code_t, uint64_t>,
+                "fields of a normalized CompositeKey must be scalar");
+  static constexpr size_t width = first_codec::width + second_codec::width;
+  static constexpr bool packed = width <= sizeof(uint64_t);
+  using code_t = std::conditional_t<packed, uint64_t, FixedKey<width>>;
+
+  static code_t encode(const CompositeKey<A, B>& key) {
+    auto high = first_codec::encode(key.first);
+    auto low = second_codec::encode(key.second);
+    code_t code;
+    if constexpr (packed) {
+      code = (high << (second_codec::width * 8)) | low;
+    } else {
+      store_big_endian(code.bytes, high, first_codec::width);
+      store_big_endian(code.bytes + first_codec::width, low,
+                       second_codec::width);
+    }
+    return code;
+  }
+
+  static CompositeKey<A, B> decode(const code_t& code) {
+    uint64_t high, low;
+    if constexpr (packed) {
+      constexpr int shift = second_codec::width * 8;
+      high = code >> shift;
+      low = code & ((uint64_t(1) << shift) - 1);
+    } else {
+      high = load_big_endian(code.bytes, first_codec::width);
+      low = load_big_endian(code.bytes + first_codec::width,
+                            second_codec::width);
+    }
+    return {first_codec::decode(high), second_codec::decode(low)};
+  }
+
+ private:
+  static void store_big_endian(uint8_t* dst, uint64_t code, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      dst[i] = uint8_t(code >> ((len - 1 - i) * 8));
+    }
+  }
+
+  static uint64_t load_big_endian(const uint8_t* src, size_t len) {
+    uint64_t code = 0;
+    for (size_t i = 0; i < len; i++) {
+      code = (code << 8) | src[i];
+    }
+    return code;
+  }
+};
+
+/**
+ * Key stored in its KeyCodec encoding, e.g. BLinkTree<Normalized<double>>.
+ * Nodes compare the codes only, so keys with a uint64_t code are searched
+ * like uint64_t keys; decode() gives back the original key.
+ */
+template <typename T>
+struct Normalized {
+  using code_t = typename KeyCodec<T>::code_t;
+  code_t code;
+
+  Normalized() = default;
+
+  Normalized(const T& key) : code(KeyCodec<T>::encode(key)) {}
+
+  T decode() const { return KeyCodec<T>::decode(code); }
+
+  friend bool operator<(const Normalized& a, const Normalized& b) {
+    return a.code < b.code;
+  }
+
+  friend bool operator==(const Normalized& a, const Normalized& b) {
+    return a.code == b.code;
+  }
+};
+
+/**
+ * Whether key_t ordered by Compare orders like its 8 bytes read as an
+ * unsigned integer, which lets nodes search it with SIMD compares.
+ */
+template <typename key_t, typename Compare>
+struct is_u64_ordered : std::false_type {};
+
+template <>
+struct is_u64_ordered<uint64_t, KeyCompare<uint64_t>> : std::true_type {};
+
+template <typename T>
+struct is_u64_ordered<Normalized<T>, KeyCompare<Normalized<T>>>
+    : std::is_same<typename Normalized<T>::code_t, uint64_t> {};
+
+/**
+ * Whether key_t ordered by Compare is a high and a low 64-bit word ordered
+ * as one unsigned 128-bit integer, see is_u64_ordered.
+ */
+template <typename key_t, typename Compare>
+struct is_u128_ordered : std::false_type {};
+
+template <>
+struct is_u128_ordered<Key128, KeyCompare<Key128>> : std::true_type {};
+
+}  // namespace BLINK_TREE
+
+template <size_t N>
+struct std::hash<BLINK_TREE::FixedKey<N>> {
+  size_t operator()(const BLINK_TREE::FixedKey<N>& key) const {
+    return std::hash<std::string_view>{}(
+        std::string_view((const char*)key.bytes, N));
+  }
+};
+
+template <>
+struct std::hash<BLINK_TREE::Key128> {
+  size_t operator()(const BLINK_TREE::Key128& key) const {
+    return std::hash<uint64_t>{}(key.high ^ (key.low * 0x9e3779b97f4a7c15ull));
+  }
+};
+
+template <typename T>
+struct std::hash<BLINK_TREE::Normalized<T>> {
+  size_t operator()(const BLINK_TREE::Normalized<T>& key) const {
+    return std::hash<typename BLINK_TREE::Normalized<T>::code_t>{}(key.code);
+  }
+};
+
+template <typename A, typename B>
+struct std::hash<BLINK_TREE::CompositeKey<A, B>> {
+  size_t operator()(const BLINK_TREE::CompositeKey<A, B>& key) const {
+    auto h = std::hash<A>{}(key.first);
+    return h ^ (std::hash<B>{}(key.second) + 0x9e3779b97f4a7c15ull + (h << 6) +
+                (h >> 2));
+  }
+};
+
+#endif  // KEY_H_
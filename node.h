@@ -11,24 +11,106 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <thread>
 #include <utility>
 
+#include "buffer.h"
+#include "key.h"
+#include "persist.h"
+
+#ifndef PAGE_SIZE
 #define PAGE_SIZE (512)
+#endif
+#define MAX_HEIGHT (32)  // upper bound of tree levels
+
+// Define ORDER_STATS to 1 to keep per-child subtree key counts in internal
+// nodes, which BLinkTree::rank(), select() and count_range() rely on.
+#ifndef ORDER_STATS
+#define ORDER_STATS (0)
+#endif
+
+// Define BUFFER_MANAGER to 1 to allocate leaves from the file backed pool of
+// buffer.h once BufferManager::open() was called, so trees can grow beyond
+// memory. PAGE_SIZE should then be BUFFER_PAGE_SIZE.
+#ifndef BUFFER_MANAGER
+#define BUFFER_MANAGER (0)
+#endif
+
+// Define PERSISTENT_TREE to 1 to allocate all nodes from the file mapped by
+// PersistentHeap::open(), with node links stored as offsets into the file,
+// so a tree is reopened from the file without loading it. Nodes then take
+// PAGE_SIZE bytes of the file each.
+#ifndef PERSISTENT_TREE
+#define PERSISTENT_TREE (0)
+#endif
+
+#if BUFFER_MANAGER && PERSISTENT_TREE
+#error "BUFFER_MANAGER and PERSISTENT_TREE are exclusive"
+#endif
 
 namespace BLINK_TREE {
 
+class Node;
+
+// link to a node as stored inside nodes
+#if PERSISTENT_TREE
+using NodeRef = OffsetPtr<Node>;
+#else
+using NodeRef = Node*;
+#endif
+
+// with PERSISTENT_TREE, the top bits of a lock word hold the generation of
+// the heap file it was locked in, see Node::need_restart()
+#define LOCK_GENERATION_SHIFT (48)
+#define LOCK_VERSION_MASK ((1ull << LOCK_GENERATION_SHIFT) - 1)
+#define LOCK_MAX_SPINS (1024)  // pauses before Node::writelock() yields
+
 class Node {
  public:
   std::atomic<uint64_t> lock;  // latch
-  Node* sibling_ptr;           // right sibling pointer
+  NodeRef sibling_ptr;         // right sibling pointer
   int cnt;                     // entries number in node
   uint32_t level;              // cur node level in blink-tree
+#if PERSISTENT_TREE
+  // generation of the heap file the node was created in, a node of an
+  // earlier one may have been split by a process that crashed
+  std::atomic<uint64_t> created_gen{PersistentHeap::generation()};
+#endif
 
  public:
-  Node() : lock(0), sibling_ptr(nullptr), cnt(0), level(0) {}
+  // version 0 marks an evicted page in buffer managed mode
+  Node()
+      : lock(BUFFER_MANAGER ? 0b100 : 0),
+        sibling_ptr(nullptr),
+        cnt(0),
+        level(0) {}
 
   Node(Node* sibling, uint32_t count, uint32_t _level)
-      : lock(0), sibling_ptr(sibling), cnt(count), level(_level) {}
+      : lock(BUFFER_MANAGER ? 0b100 : 0),
+        sibling_ptr(sibling),
+        cnt(count),
+        level(_level) {}
+
+  /**
+   * @brief whether this node was created by an earlier process using the
+   *        heap file, always false without PERSISTENT_TREE.
+   */
+  bool from_earlier_generation() {
+#if PERSISTENT_TREE
+    return created_gen.load() != PersistentHeap::generation();
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief adopt this node into the current generation of the heap file.
+   */
+  void renew_generation() {
+#if PERSISTENT_TREE
+    created_gen.store(PersistentHeap::generation());
+#endif
+  }
 
   /**
    * @brief Check whether this node is locked.
@@ -54,6 +136,9 @@ class Node {
   uint64_t try_readlock(bool& restart) {
     uint64_t version = (uint64_t)lock.load();
     need_restart(version, restart);
+    if constexpr (BUFFER_MANAGER) {
+      BufferManager::touch(this);
+    }
     return version;
   }
 
@@ -65,9 +150,10 @@ class Node {
     uint64_t version = lock.load();
     auto restart = false;
     need_restart(version, restart);
-    if (!restart) return false;
+    if (restart) return false;
 
-    if (lock.compare_exchange_strong(version, version + 0b10)) {  // lock
+    if (lock.compare_exchange_strong(version, locked(version))) {  // lock
+      undo_begin();
       return true;
     } else {
       _mm_pause();
@@ -75,6 +161,25 @@ class Node {
     }
   }
 
+  /**
+   * @brief exclusive lock, waiting for the holder with exponential backoff
+   *        that ends in yielding the CPU. For lock coupling to the right,
+   *        where the caller holds the lock of the left neighbour and cannot
+   *        restart without losing its place.
+   */
+  void writelock() {
+    for (int spins = 1; !try_writelock();) {
+      if (spins < LOCK_MAX_SPINS) {
+        for (int i = 0; i < spins; i++) {
+          _mm_pause();
+        }
+        spins *= 2;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
   /**
    * @brief upgrade to exclusive lock
    */
@@ -86,15 +191,45 @@ class Node {
       return;
     }
 
-    if (!lock.compare_exchange_strong(_version, _version + 0b10)) {
+    if (!lock.compare_exchange_strong(_version, locked(_version))) {
       _mm_pause();
       restart = true;
+      return;
     }
+    undo_begin();
+  }
+
+  void write_unlock() {
+    lock.fetch_add(0b10);
+    undo_end();
   }
 
-  void write_unlock() { lock.fetch_add(0b10); }
+  void write_unlock_obsolete() {
+    lock.fetch_add(0b11);
+    undo_end();
+  }
 
-  void write_unlock_obsolete() { lock.fetch_add(0b11); }
+  /**
+   * @brief with ordered flushes of the heap file, make the current content of
+   *        this node durable, also while it is write locked. A crash then
+   *        keeps the content even if the lock is not released.
+   */
+  void flush() {
+    if constexpr (PERSISTENT_TREE) {
+      PersistentHeap::undo_commit(this, PAGE_SIZE);
+    }
+  }
+
+  /**
+   * @brief called once a new node, filled without holding its lock, is linked
+   *        into the tree. With BUFFER_MANAGER this allows its eviction.
+   */
+  void publish() {
+    if constexpr (BUFFER_MANAGER) {
+      uint64_t version = 0b100;
+      lock.compare_exchange_strong(version, 0b1000);
+    }
+  }
 
   int get_cnt() { return cnt; }
 
@@ -106,12 +241,48 @@ class Node {
    * @param[out] restart true for need restart, false for not need restart
    */
   void need_restart(uint64_t version, bool& restart) {
-    if (is_locked(version) || is_obsolete(version)) {
+    if (PERSISTENT_TREE && is_locked(version) &&
+        ((version >> LOCK_GENERATION_SHIFT) != generation_tag())) {
+      // held by a process that crashed, its node was restored or unchanged
+      auto unlocked = ((version + 0b10) & LOCK_VERSION_MASK) |
+                      (generation_tag() << LOCK_GENERATION_SHIFT);
+      lock.compare_exchange_strong(version, unlocked);
+      restart = true;
+    } else if (is_locked(version) || is_obsolete(version)) {
       _mm_pause();
       restart = true;
+    } else if (BUFFER_MANAGER && !version) {
+      BufferManager::fault_in(this);
+      restart = true;
     }
   }
 
+  /**
+   * @brief version word of this node write locked from @p version .
+   */
+  static uint64_t locked(uint64_t version) {
+    if constexpr (PERSISTENT_TREE) {
+      return ((version + 0b10) & LOCK_VERSION_MASK) |
+             (generation_tag() << LOCK_GENERATION_SHIFT);
+    }
+    return version + 0b10;
+  }
+
+  static uint64_t generation_tag() {
+    return PersistentHeap::generation() & 0xffff;
+  }
+
+  void undo_begin() {
+    if constexpr (PERSISTENT_TREE) {
+      PersistentHeap::undo_begin(this, PAGE_SIZE, lock.load());
+    }
+  }
+
+  void undo_end() {
+    if constexpr (PERSISTENT_TREE) {
+      PersistentHeap::undo_end(this, PAGE_SIZE);
+    }
+  }
 };  // class Node
 
 template <typename key_t, typename value_t>
@@ -120,21 +291,133 @@ struct Entry {
   value_t value;
 };  // class Entry
 
+/**
+ * @brief position of the first of the @p cnt sorted entries whose key is not
+ *        less than @p key , for keys ordered as unsigned 64-bit integers
+ *        (is_u64_ordered). Keys are compared four at a time with AVX2.
+ */
+template <typename key_t, typename value_t>
+inline int lowerbound_u64(const Entry<key_t, value_t>* entry, int cnt,
+                          const key_t& key) {
+  static_assert(sizeof(key_t) == sizeof(uint64_t));
+  uint64_t target;
+  memcpy(&target, &key, sizeof(target));
+  int i = 0;
+#ifdef __AVX2__
+  if constexpr (sizeof(Entry<key_t, value_t>) == 2 * sizeof(uint64_t)) {
+    // AVX2 compares signed integers, flipping the sign bit keeps the order
+    const __m256i flip = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x(target), flip);
+    for (; i + 4 <= cnt; i += 4) {
+      // two entries per vector, unpacking gathers the four keys
+      auto lo = _mm256_loadu_si256((const __m256i*)(entry + i));
+      auto hi = _mm256_loadu_si256((const __m256i*)(entry + i + 2));
+      auto keys = _mm256_xor_si256(_mm256_unpacklo_epi64(lo, hi), flip);
+      int less = _mm256_movemask_pd(
+          _mm256_castsi256_pd(_mm256_cmpgt_epi64(needle, keys)));
+      if (less != 0xf) {
+        return i + __builtin_popcount(less);
+      }
+    }
+  }
+#endif
+  for (; i < cnt; i++) {
+    uint64_t cur;
+    memcpy(&cur, &entry[i].key, sizeof(cur));
+    if (cur >= target) {
+      break;
+    }
+  }
+  return i;
+}
+
+/**
+ * @brief lowerbound_u64() for keys ordered as unsigned 128-bit integers of a
+ *        high and a low word (is_u128_ordered). The words of four keys are
+ *        gathered across the entries and compared at once with AVX2.
+ */
+template <typename key_t, typename value_t>
+inline int lowerbound_u128(const Entry<key_t, value_t>* entry, int cnt,
+                           const key_t& key) {
+  static_assert(sizeof(key_t) == 2 * sizeof(uint64_t));
+  uint64_t target[2];
+  memcpy(target, &key, sizeof(target));
+  int i = 0;
+#ifdef __AVX2__
+  if constexpr (sizeof(Entry<key_t, value_t>) % sizeof(uint64_t) == 0) {
+    constexpr int stride = sizeof(Entry<key_t, value_t>) / sizeof(uint64_t);
+    const __m256i index =
+        _mm256_setr_epi64x(0, stride, 2 * stride, 3 * stride);
+    const __m256i flip = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i high = _mm256_xor_si256(_mm256_set1_epi64x(target[0]), flip);
+    const __m256i low = _mm256_xor_si256(_mm256_set1_epi64x(target[1]), flip);
+    for (; i + 4 <= cnt; i += 4) {
+      auto words = (const long long*)(entry + i);
+      auto highs = _mm256_xor_si256(
+          _mm256_i64gather_epi64(words, index, sizeof(uint64_t)), flip);
+      auto lows = _mm256_xor_si256(
+          _mm256_i64gather_epi64(words + 1, index, sizeof(uint64_t)), flip);
+      // high words less, or equal with low words less
+      auto less = _mm256_or_si256(
+          _mm256_cmpgt_epi64(high, highs),
+          _mm256_and_si256(_mm256_cmpeq_epi64(high, highs),
+                           _mm256_cmpgt_epi64(low, lows)));
+      int mask = _mm256_movemask_pd(_mm256_castsi256_pd(less));
+      if (mask != 0xf) {
+        return i + __builtin_popcount(mask);
+      }
+    }
+  }
+#endif
+  for (; i < cnt; i++) {
+    uint64_t cur[2];
+    memcpy(cur, &entry[i].key, sizeof(cur));
+    if ((cur[0] > target[0]) ||
+        ((cur[0] == target[0]) && (cur[1] >= target[1]))) {
+      break;
+    }
+  }
+  return i;
+}
+
+/**
+ * Whether nodes search key_t ordered by Compare with lowerbound_simd().
+ */
+template <typename key_t, typename Compare>
+inline constexpr bool simd_searchable =
+    is_u64_ordered<key_t, Compare>::value ||
+    is_u128_ordered<key_t, Compare>::value;
+
+template <typename Compare, typename key_t, typename value_t>
+inline int lowerbound_simd(const Entry<key_t, value_t>* entry, int cnt,
+                           const key_t& key) {
+  if constexpr (is_u64_ordered<key_t, Compare>::value) {
+    return lowerbound_u64(entry, cnt, key);
+  } else {
+    return lowerbound_u128(entry, cnt, key);
+  }
+}
+
 /**
  * InternalNode store next level node info.
  * p1'high_key less than k1, p2'high_key greater than k1.
  * | k1 | k2 | k3 | k4 |    |
  * | p1 | p2 | p3 | p4 | p5 |
  */
-template <typename key_t>
+template <typename key_t, typename Compare = KeyCompare<key_t>>
 class InternalNode : public Node {
  public:
   static constexpr size_t cardinality =
-      (PAGE_SIZE - sizeof(Node) - sizeof(key_t)) / sizeof(Entry<key_t, Node*>);
+      (PAGE_SIZE - sizeof(Node) - sizeof(key_t)) /
+      (sizeof(Entry<key_t, NodeRef>) + (ORDER_STATS ? sizeof(uint64_t) : 0));
+  static_assert(cardinality >= 4, "key_t is too wide for PAGE_SIZE");
   key_t high_key;
 
  private:
-  Entry<key_t, Node*> entry[cardinality];
+  Entry<key_t, NodeRef> entry[cardinality];
+#if ORDER_STATS
+  uint64_t subtree_cnt[cardinality];  // keys stored under entry[i].value
+#endif
 
  public:
   InternalNode() {}
@@ -160,6 +443,17 @@ class InternalNode : public Node {
     entry[1].value = right;
   }
 
+#if PERSISTENT_TREE
+  static void* operator new(size_t size) {
+    static_assert(sizeof(InternalNode) <= PAGE_SIZE);
+    return PersistentHeap::allocate(PAGE_SIZE);
+  }
+
+  static void operator delete(void* ptr, size_t size) {
+    PersistentHeap::release(ptr, PAGE_SIZE);
+  }
+#endif
+
   bool is_full() { return (cnt == cardinality - 1); }
 
   /**
@@ -174,7 +468,7 @@ class InternalNode : public Node {
    * @return node
    */
   Node* scan_node(key_t key) {
-    if (sibling_ptr && (high_key < key)) {
+    if (sibling_ptr && Compare::less(high_key, key)) {
       return sibling_ptr;
     } else {
       return entry[find_lowerbound(key)].value;
@@ -183,20 +477,130 @@ class InternalNode : public Node {
 
   Node* leftmost_ptr() { return entry[0].value; }
 
+  key_t key_at(int pos) { return entry[pos].key; }
+
+  Node* child_at(int pos) { return entry[pos].value; }
+
+  /**
+   * @brief position of @p child in entry, -1 if it is not a child.
+   */
+  int child_pos(Node* child) {
+    for (int i = 0; i <= cnt; i++) {
+      if (entry[i].value == child) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+#if ORDER_STATS
+  uint64_t& count_at(int pos) { return subtree_cnt[pos]; }
+
+  /**
+   * @brief keys stored under this node.
+   */
+  uint64_t total_count() {
+    uint64_t total = 0;
+    for (int i = 0; i <= cnt; i++) {
+      total += subtree_cnt[i];
+    }
+    return total;
+  }
+#endif
+
   /**
-   * @brief Insert key, pointer in sorted entry.
+   * @brief position of the child @p key leads to. Among separators equal to
+   *        @p key , which duplicate keys produce, the position of @p child .
    */
-  void insert(key_t key, Node* value) {
+  int find_child(key_t key, Node* child) {
     int pos = find_lowerbound(key);
+    while ((pos < cnt) && (entry[pos].value != child) &&
+           Compare::equal(entry[pos].key, key)) {
+      pos++;
+    }
+    return pos;
+  }
+
+  /**
+   * @brief Insert key, pointer in sorted entry, right after @p left , so
+   *        children stay in the order of their sibling chain.
+   * @param left child that split into itself and @p value
+   * @return position of @p key , @p value is stored at the next position
+   */
+  int insert(key_t key, Node* value, Node* left) {
+    int pos = find_child(key, left);
     memmove(entry + pos + 1, entry + pos,
-            sizeof(Entry<key_t, Node*>) * (cnt - pos + 1));
+            sizeof(Entry<key_t, NodeRef>) * (cnt - pos + 1));
+#if ORDER_STATS
+    memmove(subtree_cnt + pos + 1, subtree_cnt + pos,
+            sizeof(uint64_t) * (cnt - pos + 1));
+#endif
     entry[pos].key = key;
     entry[pos].value = value;
     std::swap(entry[pos].value, entry[pos + 1].value);
     cnt++;
-    if (key > high_key) {
+    if (Compare::less(high_key, key)) {
       high_key = key;
     }
+    return pos;
+  }
+
+  /**
+   * @brief append @p child with keys greater than @p key as the last child,
+   *        used when nodes are built bottom up from sorted children.
+   * @param key high key of the current last child
+   */
+  void append_child(key_t key, Node* child) {
+    entry[cnt].key = key;
+    entry[cnt + 1].value = child;
+    cnt++;
+  }
+
+  /**
+   * @brief Remove the child at @p pos , its key range is taken over by the
+   *        child on its left, which has absorbed its entries.
+   *                      | k1 | k2 | k3 |    |
+   *                      | p1 | p2 | p3 | p4 |   remove_child(2)
+   *                      | k1 | k3 |    |
+   *                      | p1 | p2 | p4 |
+   * @param pos position of removed child, greater than 0
+   */
+  void remove_child(int pos) {
+#if ORDER_STATS
+    subtree_cnt[pos - 1] += subtree_cnt[pos];
+    memmove(subtree_cnt + pos, subtree_cnt + pos + 1,
+            sizeof(uint64_t) * (cnt - pos));
+#endif
+    entry[pos].value = entry[pos - 1].value;
+    memmove(entry + pos - 1, entry + pos,
+            sizeof(Entry<key_t, NodeRef>) * (cnt - pos + 1));
+    cnt--;
+  }
+
+  /**
+   * @brief whether the entries of right sibling @p right fit into this node.
+   */
+  bool can_merge_sibling(InternalNode* right) {
+    return cnt + right->cnt + 1 <= (int)cardinality - 1;
+  }
+
+  /**
+   * @brief Append all entries of right sibling @p right , and take over its
+   *        key range and sibling ptr.
+   *        original: prev_node -> cur_node -> right -> next_node,
+   *             now: prev_node -> cur_node -> next_node
+   */
+  void merge_sibling(InternalNode* right) {
+    entry[cnt].key = high_key;
+    memcpy(entry + cnt + 1, right->entry,
+           sizeof(Entry<key_t, NodeRef>) * (right->cnt + 1));
+#if ORDER_STATS
+    memcpy(subtree_cnt + cnt + 1, right->subtree_cnt,
+           sizeof(uint64_t) * (right->cnt + 1));
+#endif
+    cnt += right->cnt + 1;
+    high_key = right->high_key;
+    sibling_ptr = right->sibling_ptr;
   }
 
   /**
@@ -215,15 +619,19 @@ class InternalNode : public Node {
    * @param[out] split_key
    * @return new allocated internal node
    */
-  InternalNode<key_t>* split(key_t& split_key) {
+  InternalNode* split(key_t& split_key) {
     int half = cnt - cnt / 2;
     split_key = entry[half].key;
 
     int new_cnt = cnt - half - 1;
-    auto new_node = new InternalNode<key_t>(sibling_ptr, new_cnt,
-                                            entry[half].value, level, high_key);
+    auto new_node = new InternalNode(sibling_ptr, new_cnt, entry[half].value,
+                                     level, high_key);
     memcpy(new_node->entry, entry + half + 1,
-           sizeof(Entry<key_t, Node*>) * (new_cnt + 1));
+           sizeof(Entry<key_t, NodeRef>) * (new_cnt + 1));
+#if ORDER_STATS
+    memcpy(new_node->subtree_cnt, subtree_cnt + half + 1,
+           sizeof(uint64_t) * (new_cnt + 1));
+#endif
 
     sibling_ptr = static_cast<Node*>(new_node);
     high_key = entry[half].key;
@@ -237,8 +645,11 @@ class InternalNode : public Node {
    * @return position of the first key that greater than @p key
    */
   int lowerbound_linear(key_t key) {
+    if constexpr (simd_searchable<key_t, Compare>) {
+      return lowerbound_simd<Compare>(entry, cnt, key);
+    }
     for (int i = 0; i < cnt; i++) {
-      if (entry[i].key >= key) {
+      if (!Compare::less(entry[i].key, key)) {
         return i;
       }
     }
@@ -252,26 +663,50 @@ class InternalNode : public Node {
  * | k1 | k2 | k3 | k4 | k5 |
  * | v1 | v2 | v3 | v4 | v5 |
  */
-template <typename key_t>
+template <typename key_t, typename Compare = KeyCompare<key_t>>
 class LeafNode : public Node {
  public:
   static constexpr size_t cardinality =
-      (PAGE_SIZE - sizeof(Node) - sizeof(key_t)) /
+      (PAGE_SIZE - sizeof(Node) - sizeof(key_t) - sizeof(uint64_t) -
+       sizeof(void*)) /
       sizeof(Entry<key_t, uint64_t>);
+  static_assert(cardinality >= 4, "key_t is too wide for PAGE_SIZE");
+  // most new nodes created by one merge()
+  static constexpr int max_merge_split = 8;
 
   key_t high_key;
+  uint64_t version_ts;  // snapshot clock of the last modification
+  LeafNode* older;      // content before version_ts, kept for snapshots
 
  private:
   Entry<key_t, uint64_t> entry[cardinality];
 
  public:
-  LeafNode() : Node() {}
+  LeafNode() : Node(), high_key(), version_ts(0), older(nullptr) {}
 
   /**
    * @brief constructor when leaf splits
    */
   LeafNode(Node* sibling, int _cnt, uint32_t _level)
-      : Node(sibling, _cnt, _level) {}
+      : Node(sibling, _cnt, _level), version_ts(0), older(nullptr) {}
+
+#if BUFFER_MANAGER
+  static void* operator new(size_t size) {
+    return BufferManager::allocate(size);
+  }
+
+  static void operator delete(void* ptr) { BufferManager::release(ptr); }
+#elif PERSISTENT_TREE
+  // a whole page, flushed and recorded for undo as one
+  static void* operator new(size_t size) {
+    static_assert(sizeof(LeafNode) <= PAGE_SIZE);
+    return PersistentHeap::allocate(PAGE_SIZE);
+  }
+
+  static void operator delete(void* ptr, size_t size) {
+    PersistentHeap::release(ptr, PAGE_SIZE);
+  }
+#endif
 
   bool is_full() { return (cnt == cardinality); }
 
@@ -287,11 +722,53 @@ class LeafNode : public Node {
    */
   uint64_t find(key_t key) { return find_linear(key); }
 
+  /**
+   * @brief smallest key stored in node, caller should ensure node is not empty.
+   */
+  key_t low_key() { return entry[0].key; }
+
+  key_t key_at(int pos) { return entry[pos].key; }
+
+  uint64_t value_at(int pos) { return entry[pos].value; }
+
+  /**
+   * @brief copy of entries and version of this node, to be kept as an older
+   *        version of it. The copy is never modified afterwards.
+   */
+  LeafNode* clone_version() {
+    // versions are read without validation, so they are never evicted
+    auto copy = ::new LeafNode(nullptr, cnt, level);
+    copy->high_key = high_key;
+    copy->version_ts = version_ts;
+    copy->older = older;
+    memcpy(copy->entry, entry, sizeof(Entry<key_t, uint64_t>) * cnt);
+    return copy;
+  }
+
+  /**
+   * @brief give this node, split from @p from , the version of @p from and
+   *        its own copy of the older versions. Snapshots only read the keys
+   *        of an older version that lie in the current range of the node.
+   */
+  void inherit_versions(LeafNode* from) {
+    version_ts = from->version_ts;
+    LeafNode** tail = &older;
+    for (auto v = from->older; v; v = v->older) {
+      *tail = v->clone_version();
+      tail = &(*tail)->older;
+    }
+    *tail = nullptr;
+  }
+
   /**
    * @brief Insert key, value in sorted entry.
+   *        Keys greater than every stored key are appended without searching.
    */
   void insert(key_t key, uint64_t value) {
-    if (cnt) {
+    if (cnt && Compare::less(entry[cnt - 1].key, key)) {
+      entry[cnt].key = key;
+      entry[cnt].value = value;
+    } else if (cnt) {
       int pos = find_lowerbound(key);
       memmove(&entry[pos + 1], &entry[pos],
               sizeof(Entry<key_t, uint64_t>) * (cnt - pos));
@@ -302,11 +779,24 @@ class LeafNode : public Node {
       entry[0].value = value;
     }
     cnt++;
-    if (key > high_key) {
+    if (Compare::less(high_key, key)) {
       high_key = key;
     }
   }
 
+  /**
+   * @brief append sorted @p keys and @p values that are not less than the
+   *        keys in node, used when leaves are built bottom up.
+   */
+  void append_sorted(const key_t* keys, const uint64_t* values, int num) {
+    for (int i = 0; i < num; i++) {
+      entry[cnt + i].key = keys[i];
+      entry[cnt + i].value = values[i];
+    }
+    cnt += num;
+    high_key = entry[cnt - 1].key;
+  }
+
   /**
    * @brief Split half entries to new node, and rearrange sibling ptr.
    *        original: prev_node -> cur_node -> next_node,
@@ -314,13 +804,14 @@ class LeafNode : public Node {
    * @param[out] split_key
    * @return new allocated leaf node
    */
-  LeafNode<key_t>* split(key_t& split_key) {
+  LeafNode* split(key_t& split_key) {
     int half = cnt / 2;
     int new_cnt = cnt - half;
     split_key = entry[half - 1].key;
 
-    auto new_leaf = new LeafNode<key_t>(sibling_ptr, new_cnt, level);
+    auto new_leaf = new LeafNode(sibling_ptr, new_cnt, level);
     new_leaf->high_key = high_key;
+    new_leaf->inherit_versions(this);
     memcpy(new_leaf->entry, entry + half,
            sizeof(Entry<key_t, uint64_t>) * new_cnt);
 
@@ -330,6 +821,88 @@ class LeafNode : public Node {
     return new_leaf;
   }
 
+  /**
+   * @brief Split for append workloads, all entries stay in current node and an
+   *        empty node is linked as right sibling, so sequentially filled leaves
+   *        end up full instead of half full.
+   *        original: prev_node -> cur_node -> next_node,
+   *             now: prev_node -> cur_node(full) -> new_node(empty) -> next_node
+   * @param[out] split_key
+   * @return new allocated leaf node
+   */
+  LeafNode* split_append(key_t& split_key) {
+    split_key = entry[cnt - 1].key;
+
+    auto new_leaf = new LeafNode(sibling_ptr, 0, level);
+    new_leaf->high_key = high_key;
+    new_leaf->inherit_versions(this);
+
+    sibling_ptr = static_cast<Node*>(new_leaf);
+    high_key = split_key;
+    return new_leaf;
+  }
+
+  /**
+   * @brief Merge sorted @p keys and @p values into node. When they do not fit,
+   *        the merged entries are spread evenly over this node and as many new
+   *        nodes as needed, which are linked as right siblings at once.
+   *        original: prev_node -> cur_node -> next_node,
+   *             now: prev_node -> cur_node -> new_node ... -> next_node
+   * @param keys   sorted keys, all of them belong to this node
+   * @param values values of @p keys
+   * @param num    number of keys, cnt + @p num must not exceed
+   * cardinality * (max_merge_split + 1)
+   * @param[out] new_leaves new allocated leaf nodes, from left to right
+   * @param[out] split_keys split_keys[i] is the high key of the node on the
+   * left of new_leaves[i]
+   * @return number of new allocated leaf nodes
+   */
+  int merge(const key_t* keys, const uint64_t* values, int num,
+            LeafNode** new_leaves, key_t* split_keys) {
+    int total = cnt + num;
+    if (Compare::less(high_key, keys[num - 1])) {
+      high_key = keys[num - 1];
+    }
+
+    if (total <= (int)cardinality) {
+      merge_entries(entry, entry, cnt, keys, values, num);
+      cnt = total;
+      return 0;
+    }
+
+    Entry<key_t, uint64_t> buf[cardinality * (max_merge_split + 1)];
+    merge_entries(buf, entry, cnt, keys, values, num);
+
+    int nodes = (total + cardinality - 1) / cardinality;
+    int per_node = total / nodes;
+    int extra = total % nodes;
+
+    auto last_high_key = high_key;
+    auto next = sibling_ptr;
+    int pos = per_node + (extra > 0);
+    memcpy(entry, buf, sizeof(Entry<key_t, uint64_t>) * pos);
+    cnt = pos;
+    high_key = entry[cnt - 1].key;
+
+    LeafNode* prev = this;
+    for (int i = 1; i < nodes; i++) {
+      int node_cnt = per_node + (i < extra);
+      auto new_leaf = new LeafNode(next, node_cnt, level);
+      new_leaf->inherit_versions(this);
+      memcpy(new_leaf->entry, buf + pos,
+             sizeof(Entry<key_t, uint64_t>) * node_cnt);
+      pos += node_cnt;
+      new_leaf->high_key =
+          (i == nodes - 1) ? last_high_key : new_leaf->entry[node_cnt - 1].key;
+
+      split_keys[i - 1] = prev->high_key;
+      new_leaves[i - 1] = new_leaf;
+      prev->sibling_ptr = static_cast<Node*>(new_leaf);
+      prev = new_leaf;
+    }
+    return nodes - 1;
+  }
+
   bool remove(key_t key) {
     if (cnt) {
       int pos = find_pos_linear(key);
@@ -343,19 +916,100 @@ class LeafNode : public Node {
     return false;
   }
 
+  /**
+   * @brief remove all keys within [ @p low_key , @p high_key ), or
+   *        [ @p low_key , @p high_key ] if @p closed .
+   * @param[out] span smallest and largest removed key, set if any is removed,
+   * may be nullptr
+   * @return number of removed keys
+   */
+  int remove_range(key_t low_key, key_t high_key, bool closed = false,
+                   key_t* span = nullptr) {
+    int from = find_lowerbound(low_key);
+    int to = from;
+    while ((to < cnt) && (closed ? !Compare::less(high_key, entry[to].key)
+                                 : Compare::less(entry[to].key, high_key))) {
+      to++;
+    }
+    if (span && (to > from)) {
+      span[0] = entry[from].key;
+      span[1] = entry[to - 1].key;
+    }
+    memmove(&entry[from], &entry[to],
+            sizeof(Entry<key_t, uint64_t>) * (cnt - to));
+    cnt -= to - from;
+    return to - from;
+  }
+
+  /**
+   * @brief whether the entries of right sibling @p right fit into this node.
+   */
+  bool can_merge_sibling(LeafNode* right) {
+    return cnt + right->cnt <= (int)cardinality;
+  }
+
+  /**
+   * @brief Append all entries of right sibling @p right , and take over its
+   *        key range and sibling ptr.
+   *        original: prev_node -> cur_node -> right -> next_node,
+   *             now: prev_node -> cur_node -> next_node
+   */
+  void merge_sibling(LeafNode* right) {
+    memcpy(entry + cnt, right->entry,
+           sizeof(Entry<key_t, uint64_t>) * right->cnt);
+    cnt += right->cnt;
+    high_key = right->high_key;
+    sibling_ptr = right->sibling_ptr;
+  }
+
   bool update(key_t key, uint64_t value) { return update_linear(key, value); }
 
+  /**
+   * @brief find the value slot of @p key .
+   * @return address of the value, nullptr if @p key does not exist.
+   */
+  uint64_t* find_value(key_t key) {
+    int pos = find_pos_linear(key);
+    return (pos == -1) ? nullptr : &entry[pos].value;
+  }
+
+  /**
+   * @brief copy values from position @p idx to the end of node into @p buf ,
+   *        until @p range values are collected.
+   * @param idx first entry to copy
+   * @param[out] buf values buffer
+   * @param count values already in @p buf
+   * @param range capacity of @p buf
+   * @return values in @p buf after copy
+   */
+  int range_lookup(int idx, uint64_t* buf, int count, int range) {
+    for (int i = idx; (i < cnt) && (count < range); i++) {
+      buf[count++] = entry[i].value;
+    }
+    return count;
+  }
+
  private:
   int lowerbound_linear(key_t key) {
+    if constexpr (simd_searchable<key_t, Compare>) {
+      return lowerbound_simd<Compare>(entry, cnt, key);
+    }
     for (int i = 0; i < cnt; i++) {
-      if (key <= entry[i].key) return i;
+      if (!Compare::less(entry[i].key, key)) return i;
     }
     return cnt;
   }
 
   bool update_linear(key_t key, uint64_t value) {
+    if constexpr (simd_searchable<key_t, Compare>) {
+      int pos = find_pos_linear(key);
+      if (pos != -1) {
+        entry[pos].value = value;
+      }
+      return pos != -1;
+    }
     for (int i = 0; i < cnt; i++) {
-      if (key == entry[i].key) {
+      if (Compare::equal(key, entry[i].key)) {
         entry[i].value = value;
         return true;
       }
@@ -364,8 +1018,12 @@ class LeafNode : public Node {
   }
 
   uint64_t find_linear(key_t key) {
+    if constexpr (simd_searchable<key_t, Compare>) {
+      int pos = find_pos_linear(key);
+      return (pos == -1) ? 0 : entry[pos].value;
+    }
     for (int i = 0; i < cnt; i++) {
-      if (key == entry[i].key) {
+      if (Compare::equal(key, entry[i].key)) {
         auto ret = entry[i].value;
         return ret;
       }
@@ -373,9 +1031,36 @@ class LeafNode : public Node {
     return 0;
   }
 
+  /**
+   * @brief merge sorted node entries @p src and sorted @p keys into @p dst
+   *        from the back, @p dst may be the same array as @p src .
+   */
+  static void merge_entries(Entry<key_t, uint64_t>* dst,
+                            Entry<key_t, uint64_t>* src, int src_cnt,
+                            const key_t* keys, const uint64_t* values,
+                            int num) {
+    int i = src_cnt - 1, j = num - 1, k = src_cnt + num - 1;
+    while (j >= 0) {
+      if (i >= 0 && Compare::less(keys[j], src[i].key)) {
+        dst[k--] = src[i--];
+      } else {
+        dst[k].key = keys[j];
+        dst[k--].value = values[j--];
+      }
+    }
+    while (i >= 0) {
+      dst[k--] = src[i--];
+    }
+  }
+
   int find_pos_linear(key_t key) {
+    if constexpr (simd_searchable<key_t, Compare>) {
+      // the first key not less than key is the first equal one, if any
+      int pos = lowerbound_simd<Compare>(entry, cnt, key);
+      return ((pos < cnt) && Compare::equal(key, entry[pos].key)) ? pos : -1;
+    }
     for (int i = 0; i < cnt; i++) {
-      if (key == entry[i].key) {
+      if (Compare::equal(key, entry[i].key)) {
         return i;
       }
     }
@@ -0,0 +1,730 @@
+#ifndef PERSIST_H_
+#define PERSIST_H_
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "checkpoint.h"
+#include "epoch.h"
+
+#define HEAP_SIZE_CLASSES (16)        // block sizes 64 << 0 .. 64 << 15 bytes
+#define HEAP_GROW_BYTES (64ull << 20)  // file growth step
+#ifndef HEAP_UNDO_DEPTH
+#define HEAP_UNDO_DEPTH (16)  // first undo records of a thread, doubled on need
+#endif
+#define HEAP_FORMAT (3)
+
+namespace BLINK_TREE {
+
+/**
+ * First page of a heap file. Offsets are bytes from the start of the file,
+ * 0 stands for nullptr since the header is never allocated.
+ */
+struct HeapHeader {
+  char magic[8];  // "BLNKHEAP"
+  uint32_t format;
+  uint32_t clean;  // closed by close(), no operation was in flight
+  uint64_t layout;  // tag of the tree whose root is stored, 0 if none
+  std::atomic<uint64_t> top;    // bytes handed out by the bump allocator
+  std::atomic<uint64_t> root;   // offset of the root node of the tree
+  std::atomic<uint64_t> clock;  // upper bound of snapshot clocks in nodes
+  std::atomic<uint64_t> free_list[HEAP_SIZE_CLASSES];  // first free block
+  std::atomic<uint64_t> rightmost;  // offset of the rightmost leaf, a hint
+  std::atomic<uint32_t> alloc_lock;  // protects top and free_list
+  uint32_t shared;      // a shared memory segment, see open_shared()
+  uint64_t generation;  // number of times the file was opened
+  std::atomic<uint64_t> undo[MAX_THREADS];  // undo area of each thread slot
+};
+
+/**
+ * Content of a node before the write lock held on it, kept in the undo area
+ * of the locking thread while ordered flushes are on.
+ */
+struct UndoRecord {
+  uint32_t crc;     // crc32c of the rest of the record and the content
+  uint32_t len;     // bytes of content following the record
+  uint64_t target;  // offset of the node, 0 if the record is free
+  uint64_t lock;    // locked version word the content was captured with
+  uint64_t pad;
+};
+
+static constexpr char heap_magic[8] = {'B', 'L', 'N', 'K',
+                                       'H', 'E', 'A', 'P'};
+
+/**
+ * Process wide heap of tree nodes inside one memory mapped file, so a tree
+ * outlives the process and is usable as soon as the file is mapped again.
+ * The file is mapped at the start of a reserved range of virtual memory and
+ * grows in place, at whatever address the range lands in each process, so
+ * nodes refer to each other by OffsetPtr. Blocks come from power of two size
+ * classes, freed blocks are kept on per-class free lists linked through the
+ * file, so the allocator state is persistent as well. A crash may leak the
+ * blocks that were being allocated or freed.
+ *
+ * With ordered flushes, modifications reach the file in an order recovery
+ * can rely on, msync standing in for cache line flushes and fences:
+ * - a node is copied to an undo record of the locking thread, which is
+ *   flushed before the node is modified, and the node is flushed when it is
+ *   unlocked. A node found locked in the file after a crash is restored from
+ *   the record captured with that very lock word, if any, when the file is
+ *   opened again. That touches the few records of the previous process, not
+ *   the tree.
+ * - a new node is flushed before it is linked, and allocator state is
+ *   flushed before a block is handed out.
+ * The file then holds a tree whose nodes are each as they were before or
+ * after an operation; what an interrupted split or merge left undone is
+ * finished lazily by the tree (see BLinkTree::complete_split()).
+ *
+ * The heap may instead live in a POSIX shared memory segment that several
+ * processes map at once, see open_shared(). Version locks are words in the
+ * segment, so they work across processes like across threads.
+ */
+class PersistentHeap {
+ public:
+  /**
+   * @brief map the heap file at @p path , created if missing. Must be called
+   *        before any tree allocates nodes.
+   * @param reserve_bytes virtual memory reserved for the file, bounds its
+   * size
+   * @param ordered_flush flush modifications in order so the tree survives a
+   * crash, at the cost of a few msync calls per write lock
+   * @return false if the file cannot be mapped or is not a heap file
+   */
+  static bool open(const char* path, uint64_t reserve_bytes = 64ull << 30,
+                   bool ordered_flush = false) {
+    auto heap = new PersistentHeap();
+    heap->ordered = ordered_flush;
+    if (!heap->init(path, reserve_bytes)) {
+      delete heap;
+      return false;
+    }
+    install(heap);
+    return true;
+  }
+
+  /**
+   * @brief map the POSIX shared memory segment @p name , created with
+   *        @p capacity bytes if missing, as the heap. Processes opening the
+   *        same segment share one tree: a BLinkTree constructed in any of
+   *        them attaches to the tree the first one created. Nodes are never
+   *        reused once freed, since readers of other processes are not
+   *        tracked by the epochs of this one. Snapshots, checkpoints and the
+   *        write-ahead log stay per process and are not supported on a shared
+   *        tree. A process dying while it holds a write lock leaves the node
+   *        locked.
+   * @param capacity size of a new segment, memory is taken as it is touched
+   * @return false if the segment cannot be mapped or is not a heap
+   */
+  static bool open_shared(const char* name, uint64_t capacity = 1ull << 30) {
+    auto heap = new PersistentHeap();
+    if (!heap->init_shared(name, capacity)) {
+      delete heap;
+      return false;
+    }
+    install(heap);
+    return true;
+  }
+
+  /**
+   * @brief remove the shared memory segment @p name , processes that mapped
+   *        it keep using it until they close it.
+   */
+  static bool unlink_shared(const char* name) {
+    return ::shm_unlink(name) == 0;
+  }
+
+  /**
+   * @brief flush the file, mark it clean and unmap it. No tree may use the
+   *        heap any more.
+   */
+  static void close() {
+    auto heap = instance;
+    if (!heap) {
+      return;
+    }
+    // other processes may still use a shared segment
+    if (!heap->shared) {
+      sync();
+      heap->header->clean = 1;
+      persist(heap->header, sizeof(HeapHeader));
+    }
+    instance = nullptr;
+    base = nullptr;
+    current_generation = 0;
+    delete heap;
+  }
+
+  static bool is_open() { return instance != nullptr; }
+
+  static bool is_shared() { return instance && instance->shared; }
+
+  /**
+   * @brief whether the file was closed by close() when it was opened, false
+   *        for a new file and after a crash.
+   */
+  static bool was_clean() { return instance && instance->clean_open; }
+
+  /**
+   * @brief number of times the open heap file was opened, 0 without a heap.
+   *        Locks and nodes of an earlier generation were left by a previous
+   *        process.
+   */
+  static uint64_t generation() { return current_generation; }
+
+  /**
+   * @brief with ordered flushes, record the content of @p node , just write
+   *        locked with version word @p lock , before it is modified.
+   */
+  static void undo_begin(const void* node, size_t len, uint64_t lock) {
+    auto heap = instance;
+    if (!heap || !heap->ordered || !heap->contains(node)) {
+      return;
+    }
+    write_record(heap->free_record(len), node, len, lock);
+  }
+
+  /**
+   * @brief with ordered flushes, make the current content of the write
+   *        locked @p node durable, recovery restores it rather than the
+   *        content from before the lock.
+   */
+  static void undo_commit(const void* node, size_t len) {
+    auto heap = instance;
+    if (!heap || !heap->ordered || !heap->contains(node)) {
+      return;
+    }
+    persist(node, len);
+    // a torn record fails its crc, the node in the file is then current
+    if (auto record = heap->find_record(node)) {
+      write_record(record, node, len, record->lock);
+    }
+  }
+
+  /**
+   * @brief with ordered flushes, flush @p node , just unlocked, and drop its
+   *        undo record.
+   */
+  static void undo_end(const void* node, size_t len) {
+    auto heap = instance;
+    if (!heap || !heap->ordered || !heap->contains(node)) {
+      return;
+    }
+    persist(node, len);
+    if (auto record = heap->find_record(node)) {
+      // the block may be freed and locked again with the same word
+      record->target = 0;
+      persist(&record->target, sizeof(record->target));
+    }
+  }
+
+  /**
+   * @brief with ordered flushes, persist() [ @p ptr , @p ptr + @p len ).
+   */
+  static void flush(const void* ptr, size_t len) {
+    if (instance && instance->ordered) {
+      persist(ptr, len);
+    }
+  }
+
+  /**
+   * @brief allocate @p size bytes from the heap file, from operator new if
+   *        no heap is open.
+   */
+  static void* allocate(size_t size) {
+    auto heap = instance;
+    if (!heap) {
+      return ::operator new(size);
+    }
+    auto ptr = heap->allocate_block(size);
+    if (!ptr) {
+      throw std::bad_alloc();
+    }
+    return ptr;
+  }
+
+  /**
+   * @brief free the block at @p ptr of @p size bytes, memory outside the heap
+   *        goes back to operator delete.
+   */
+  static void release(void* ptr, size_t size) {
+    auto heap = instance;
+    if (heap && heap->contains(ptr)) {
+      heap->release_block(ptr, size);
+    } else {
+      ::operator delete(ptr);
+    }
+  }
+
+  /**
+   * @brief write the pages holding [ @p ptr , @p ptr + @p len ) back to the
+   *        file and wait for them. Nothing to do for memory outside the heap.
+   */
+  static void persist(const void* ptr, size_t len) {
+    auto heap = instance;
+    if (!heap || !heap->contains(ptr)) {
+      return;
+    }
+    auto from = reinterpret_cast<uintptr_t>(ptr) & ~(uintptr_t)(4095);
+    auto to = reinterpret_cast<uintptr_t>(ptr) + len;
+    ::msync(reinterpret_cast<void*>(from), to - from, MS_SYNC);
+  }
+
+  /**
+   * @brief write every modified page of the heap back to the file. Nodes
+   *        reach the file in no particular order, callers sync when no
+   *        operation is in flight to get a consistent image.
+   */
+  static void sync() {
+    auto heap = instance;
+    if (heap) {
+      AllocGuard guard(heap->header);
+      ::msync(heap->addr, heap->mapped, MS_SYNC);
+    }
+  }
+
+  /**
+   * @brief header of the open heap, nullptr if none.
+   */
+  static HeapHeader* header_of() {
+    return instance ? instance->header : nullptr;
+  }
+
+  static uint64_t to_offset(const void* ptr) {
+    return ptr ? static_cast<const char*>(ptr) - base : 0;
+  }
+
+  static void* from_offset(uint64_t off) { return off ? base + off : nullptr; }
+
+  /**
+   * @brief bytes allocated from the file so far.
+   */
+  static uint64_t used_bytes() {
+    return instance ? instance->header->top.load() : 0;
+  }
+
+ private:
+  /**
+   * holds the allocator lock in the heap header, which processes sharing the
+   * heap take as well
+   */
+  class AllocGuard {
+   public:
+    explicit AllocGuard(HeapHeader* _header) : header(_header) {
+      uint32_t unlocked = 0;
+      while (!header->alloc_lock.compare_exchange_weak(unlocked, 1)) {
+        unlocked = 0;
+        sched_yield();
+      }
+    }
+    ~AllocGuard() { header->alloc_lock.store(0); }
+
+   private:
+    HeapHeader* header;
+  };
+
+  PersistentHeap()
+      : fd(-1),
+        addr(nullptr),
+        reserved(0),
+        mapped(0),
+        header(nullptr),
+        clean_open(false),
+        ordered(false),
+        shared(false) {}
+
+  static void install(PersistentHeap* heap) {
+    base = heap->addr;
+    current_generation = heap->header->generation;
+    instance = heap;
+  }
+
+  ~PersistentHeap() {
+    if (addr) {
+      ::munmap(addr, reserved);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  bool init(const char* path, uint64_t reserve_bytes) {
+    fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      return false;
+    }
+    reserved = reserve_bytes;
+    auto range = ::mmap(nullptr, reserved, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (range == MAP_FAILED) {
+      return false;
+    }
+    addr = static_cast<char*>(range);
+
+    bool fresh = st.st_size == 0;
+    if (!map_file(fresh ? HEAP_GROW_BYTES : st.st_size)) {
+      return false;
+    }
+    header = reinterpret_cast<HeapHeader*>(addr);
+    if (fresh) {
+      memset(static_cast<void*>(header), 0, sizeof(HeapHeader));
+      memcpy(header->magic, heap_magic, sizeof(header->magic));
+      header->format = HEAP_FORMAT;
+      header->top.store(4096);
+    } else if (memcmp(header->magic, heap_magic, sizeof(header->magic)) ||
+               (header->format != HEAP_FORMAT) ||
+               (header->top.load() > mapped)) {
+      return false;
+    }
+    if (header->shared) {
+      return false;
+    }
+    clean_open = !fresh && header->clean;
+    if (!fresh && !header->clean) {
+      recover_undo();
+    }
+    // no other process maps the file, a crash may have left it held
+    header->alloc_lock.store(0);
+    header->clean = 0;
+    header->generation++;
+    ::msync(addr, 4096, MS_SYNC);
+    return true;
+  }
+
+  /**
+   * @brief create or map the shared memory segment @p name . The creator
+   *        sizes the segment and writes the header, the magic last, others
+   *        wait for it. The segment is mapped whole, it does not grow.
+   */
+  bool init_shared(const char* name, uint64_t capacity) {
+    shared = true;
+    bool fresh = true;
+    fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ((fd < 0) && (errno == EEXIST)) {
+      fresh = false;
+      fd = ::shm_open(name, O_RDWR, 0600);
+    }
+    if ((fd < 0) || (fresh && (::ftruncate(fd, capacity) != 0))) {
+      return false;
+    }
+
+    // a creator that does not finish within about a second is gone
+    struct stat st;
+    for (int i = 0; (::fstat(fd, &st) == 0) && !st.st_size; i++) {
+      if (i == 1000) {
+        return false;
+      }
+      ::usleep(1000);
+    }
+    reserved = mapped = st.st_size;
+    auto ret =
+        ::mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ret == MAP_FAILED) {
+      return false;
+    }
+    addr = static_cast<char*>(ret);
+    header = reinterpret_cast<HeapHeader*>(addr);
+
+    if (fresh) {
+      header->format = HEAP_FORMAT;
+      header->top.store(4096);
+      header->shared = 1;
+      header->generation = 1;
+      std::atomic_thread_fence(std::memory_order_release);
+      memcpy(header->magic, heap_magic, sizeof(header->magic));
+      return true;
+    }
+    for (int i = 0; memcmp(header->magic, heap_magic, sizeof(header->magic));
+         i++) {
+      if (i == 1000) {
+        return false;
+      }
+      ::usleep(1000);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return (header->format == HEAP_FORMAT) && header->shared;
+  }
+
+  /**
+   * @brief restore the nodes that were write locked when the previous
+   *        process stopped from the undo records captured with their lock
+   *        words. The first word of a node is its version lock.
+   */
+  void recover_undo() {
+    for (auto& area : header->undo) {
+      if (!area.load()) {
+        continue;
+      }
+      auto stride = undo_stride_of(area.load());
+      auto depth = undo_depth_of(area.load());
+      for (uint64_t i = 0; i < depth; i++) {
+        auto record = record_at(area.load(), stride, i);
+        if (!record->target || (record->target >= header->top.load()) ||
+            (sizeof(UndoRecord) + record->len > stride)) {
+          continue;
+        }
+        auto crc =
+            crc32c(&record->len, sizeof(UndoRecord) - sizeof(uint32_t));
+        crc = crc32c(record + 1, record->len, crc);
+        auto node = addr + record->target;
+        if ((crc == record->crc) &&
+            (*reinterpret_cast<uint64_t*>(node) == record->lock)) {
+          memcpy(node, record + 1, record->len);
+        }
+        record->target = 0;
+      }
+    }
+    ::msync(addr, mapped, MS_SYNC);
+  }
+
+  static void write_record(UndoRecord* record, const void* node, size_t len,
+                           uint64_t lock) {
+    record->len = len;
+    record->lock = lock;
+    memcpy(record + 1, node, len);
+    record->target = to_offset(node);
+    record->crc = crc32c(&record->len, sizeof(UndoRecord) - sizeof(uint32_t));
+    record->crc = crc32c(record + 1, len, record->crc);
+    persist(record, sizeof(UndoRecord) + len);
+  }
+
+  static uint64_t undo_stride(size_t len) {
+    return (sizeof(UndoRecord) + len + 63) / 64 * 64;
+  }
+
+  // an undo area starts with its record stride and number of records,
+  // records follow at 64 bytes
+  uint64_t undo_stride_of(uint64_t area) const {
+    return *reinterpret_cast<uint64_t*>(addr + area);
+  }
+
+  // 0 in areas of files written before areas could grow
+  uint64_t undo_depth_of(uint64_t area) const {
+    auto depth = *reinterpret_cast<uint64_t*>(addr + area + 8);
+    return depth ? depth : HEAP_UNDO_DEPTH;
+  }
+
+  UndoRecord* record_at(uint64_t area, uint64_t stride, uint64_t idx) const {
+    return reinterpret_cast<UndoRecord*>(addr + area + 64 + idx * stride);
+  }
+
+  /**
+   * @brief a free record of the calling thread for @p len bytes of content,
+   *        the undo area of the thread is allocated on first use and grown
+   *        when the thread holds a write lock on every record.
+   */
+  UndoRecord* free_record(size_t len) {
+    auto& area = header->undo[ThreadSlot::id()];
+    if (!area.load()) {
+      grow_undo(area, undo_stride(len), HEAP_UNDO_DEPTH);
+    } else if (undo_stride_of(area.load()) < undo_stride(len)) {
+      grow_undo(area, undo_stride(len), undo_depth_of(area.load()));
+    }
+    auto stride = undo_stride_of(area.load());
+    auto depth = undo_depth_of(area.load());
+    for (uint64_t i = 0; i < depth; i++) {
+      auto record = record_at(area.load(), stride, i);
+      if (!record->target) {
+        return record;
+      }
+    }
+    // records in use are copied to the front of the grown area
+    grow_undo(area, stride, depth * 2);
+    return record_at(area.load(), stride, depth);
+  }
+
+  /**
+   * @brief replace the undo area @p area of a thread by one of @p depth
+   *        records of @p stride bytes, holding the records in use. The new
+   *        area is durable before @p area refers to it, so recovery finds
+   *        the records in one of both.
+   */
+  void grow_undo(std::atomic<uint64_t>& area, uint64_t stride,
+                 uint64_t depth) {
+    auto size = 64 + depth * stride;
+    auto block = static_cast<char*>(allocate_block(size));
+    if (!block) {
+      throw std::bad_alloc();
+    }
+    memset(block, 0, size);
+    reinterpret_cast<uint64_t*>(block)[0] = stride;
+    reinterpret_cast<uint64_t*>(block)[1] = depth;
+    auto old = area.load();
+    if (old) {
+      auto old_stride = undo_stride_of(old);
+      uint64_t used = 0;
+      for (uint64_t i = 0; i < undo_depth_of(old); i++) {
+        auto record = record_at(old, old_stride, i);
+        if (record->target) {
+          memcpy(block + 64 + used++ * stride, record,
+                 sizeof(UndoRecord) + record->len);
+        }
+      }
+    }
+    persist(block, size);
+    area.store(block - addr);
+    persist(&area, sizeof(area));
+    if (old) {
+      release_block(addr + old, 64 + undo_depth_of(old) * undo_stride_of(old));
+    }
+  }
+
+  UndoRecord* find_record(const void* node) const {
+    auto area = header->undo[ThreadSlot::id()].load();
+    if (!area) {
+      return nullptr;
+    }
+    auto stride = undo_stride_of(area);
+    auto depth = undo_depth_of(area);
+    auto target = to_offset(node);
+    for (uint64_t i = 0; i < depth; i++) {
+      auto record = record_at(area, stride, i);
+      if (record->target == target) {
+        return record;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * @brief extend the file and its mapping to @p size bytes, the range
+   *        keeps its address.
+   */
+  bool map_file(uint64_t size) {
+    if (shared) {
+      return size <= mapped;
+    }
+    size = (size + HEAP_GROW_BYTES - 1) / HEAP_GROW_BYTES * HEAP_GROW_BYTES;
+    if (size <= mapped) {
+      return true;
+    }
+    if ((size > reserved) || (::ftruncate(fd, size) != 0)) {
+      return false;
+    }
+    auto ret = ::mmap(addr + mapped, size - mapped, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_FIXED, fd, mapped);
+    if (ret == MAP_FAILED) {
+      return false;
+    }
+    mapped = size;
+    return true;
+  }
+
+  bool contains(const void* ptr) const {
+    auto p = static_cast<const char*>(ptr);
+    return (p >= addr) && (p < addr + reserved);
+  }
+
+  static int size_class(size_t size) {
+    int cls = 0;
+    while (((size_t)64 << cls) < size) {
+      cls++;
+    }
+    return cls;
+  }
+
+  void* allocate_block(size_t size) {
+    int cls = size_class(size);
+    if (cls >= HEAP_SIZE_CLASSES) {
+      return nullptr;
+    }
+    AllocGuard guard(header);
+    auto& head = header->free_list[cls];
+    if (auto off = head.load()) {
+      // a free block holds the offset of the next one in its second word
+      head.store(reinterpret_cast<uint64_t*>(addr + off)[1]);
+      persist_allocator();
+      return addr + off;
+    }
+    uint64_t block = (uint64_t)64 << cls;
+    uint64_t align = std::min<uint64_t>(block, 4096);
+    auto off = (header->top.load() + align - 1) / align * align;
+    if (!map_file(off + block)) {
+      return nullptr;
+    }
+    header->top.store(off + block);
+    persist_allocator();
+    return addr + off;
+  }
+
+  void release_block(void* ptr, size_t size) {
+    // freed nodes are retired, so no thread of this process reads them
+    if (shared) {
+      return;
+    }
+    int cls = size_class(size);
+    AllocGuard guard(header);
+    auto& head = header->free_list[cls];
+    reinterpret_cast<uint64_t*>(ptr)[1] = head.load();
+    if (ordered) {
+      persist(ptr, 2 * sizeof(uint64_t));
+    }
+    head.store(static_cast<char*>(ptr) - addr);
+    persist_allocator();
+  }
+
+  void persist_allocator() {
+    if (ordered) {
+      persist(header, offsetof(HeapHeader, generation));
+    }
+  }
+
+  int fd;
+  char* addr;         // start of reserved range, file offset 0
+  uint64_t reserved;  // bytes of virtual memory reserved
+  uint64_t mapped;    // bytes of the file mapped
+  HeapHeader* header;
+  bool clean_open;
+  bool ordered;  // flush modifications in order, see undo_begin()
+  bool shared;   // a shared memory segment, see open_shared()
+
+  static inline PersistentHeap* instance = nullptr;
+  static inline char* base = nullptr;  // address of file offset 0
+  static inline uint64_t current_generation = 0;
+};  // class PersistentHeap
+
+/**
+ * Pointer stored as an offset into the heap file, so a node link stays
+ * valid wherever the file is mapped. Without an open heap the offset is the
+ * address itself. Converts to and from T* like a raw pointer, entries holding
+ * offsets may be copied with memcpy.
+ */
+template <typename T>
+class OffsetPtr {
+ public:
+  OffsetPtr() = default;
+  OffsetPtr(std::nullptr_t) : off(0) {}
+  OffsetPtr(T* ptr) : off(PersistentHeap::to_offset(ptr)) {}
+
+  T* get() const { return static_cast<T*>(PersistentHeap::from_offset(off)); }
+
+  operator T*() const { return get(); }
+
+  template <typename U>
+  explicit operator U*() const {
+    return static_cast<U*>(get());
+  }
+
+  T* operator->() const { return get(); }
+
+ private:
+  uint64_t off;
+};  // class OffsetPtr
+
+}  // namespace BLINK_TREE
+
+#endif  // PERSIST_H_
@@ -0,0 +1,305 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blinktree.h"
+
+using Key_t = uint64_t;
+
+using namespace BLINK_TREE;
+
+using Model = std::map<Key_t, uint64_t>;
+
+#define KEYS_PER_THREAD (20000)
+
+static bool failed = false;
+
+/**
+ * @brief report a failed check of @p what without stopping, so every check
+ *        runs and main() returns non-zero.
+ */
+void check(bool cond, const std::string& what) {
+  if (!cond) {
+    std::cout << "FAILED: " << what << std::endl;
+    failed = true;
+  }
+}
+
+/**
+ * @brief whether @p tree holds exactly the pairs of @p model .
+ */
+template <typename key_t>
+bool matches(BLinkTree<key_t>& tree, const std::map<key_t, uint64_t>& model) {
+  auto report = tree.verify();
+  if (!report.ok || (report.num_keys != model.size())) {
+    return false;
+  }
+  for (auto& [key, value] : model) {
+    if (tree.lookup(key) != value) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief run @p num_ops random modifications of thread @p tid on its own keys
+ *        [tid * KEYS_PER_THREAD, (tid + 1) * KEYS_PER_THREAD), mirroring them
+ *        in @p model . Values are never 0, which stands for a missing key.
+ */
+void modify(BLinkTree<Key_t>* tree, int tid, int num_ops, uint64_t seed,
+            Model& model) {
+  std::mt19937_64 rng(seed * 1000 + tid);
+  Key_t base = (Key_t)tid * KEYS_PER_THREAD;
+  for (int i = 0; i < num_ops; i++) {
+    Key_t key = base + rng() % KEYS_PER_THREAD;
+    uint64_t value = (rng() >> 24) + 1;
+    auto it = model.find(key);
+    int dice = rng() % 100;
+    if (dice < 40) {
+      tree->upsert(key, value);
+      model[key] = value;
+    } else if (dice < 50) {
+      if (tree->insert_if_absent(key, value)) {
+        model[key] = value;
+      }
+    } else if (dice < 60) {
+      if (tree->update(key, value)) {
+        model[key] = value;
+      }
+    } else if (dice < 80) {
+      tree->remove(key);
+      model.erase(key);
+    } else if (dice < 88) {
+      uint64_t expected = (it != model.end()) ? it->second : value;
+      if (tree->compare_exchange(key, expected, value)) {
+        model[key] = value;
+      }
+    } else if (dice < 97) {
+      model[key] = tree->fetch_add(key, value) + value;
+    } else {
+      Key_t high = std::min(key + rng() % 64 + 1, base + KEYS_PER_THREAD);
+      tree->remove_range(key, high);
+      model.erase(model.lower_bound(key), model.lower_bound(high));
+    }
+  }
+}
+
+/**
+ * @brief modify() by @p num_threads threads at once, merging their models
+ *        into @p model .
+ */
+void modify_concurrently(BLinkTree<Key_t>* tree, int num_threads, int num_ops,
+                         uint64_t seed, Model& model) {
+  std::vector<Model> models(num_threads);
+  for (auto& [key, value] : model) {
+    models[key / KEYS_PER_THREAD][key] = value;
+  }
+  std::vector<std::thread> threads;
+  for (int tid = 0; tid < num_threads; tid++) {
+    threads.emplace_back(modify, tree, tid, num_ops, seed,
+                         std::ref(models[tid]));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  model.clear();
+  for (auto& part : models) {
+    model.insert(part.begin(), part.end());
+  }
+}
+
+/**
+ * @brief names of the files in @p dir .
+ */
+std::vector<std::string> list_files(const std::string& dir) {
+  std::vector<std::string> names;
+  if (auto dp = ::opendir(dir.c_str())) {
+    while (auto ent = ::readdir(dp)) {
+      if (ent->d_type == DT_REG) {
+        names.push_back(ent->d_name);
+      }
+    }
+    ::closedir(dp);
+  }
+  return names;
+}
+
+/**
+ * @brief remove the files left in @p dir by a previous run.
+ */
+void clear_dir(const std::string& dir) {
+  for (auto& name : list_files(dir)) {
+    ::unlink((dir + "/" + name).c_str());
+  }
+}
+
+/**
+ * @brief log modifications with group commit, checkpoint and truncate the
+ *        log in between, then recover() fresh trees from checkpoint and log
+ *        and compare them against the model, twice in a row.
+ */
+void check_wal(const std::string& dir, int num_threads) {
+  auto wal_dir = dir + "/wal";
+  auto path = dir + "/wal.ckpt";
+  clear_dir(wal_dir);
+  ::unlink(path.c_str());
+  WalOptions options;
+  options.segment_bytes = 64 << 10;  // rotate often
+  Model model;
+
+  {
+    BLinkTree<Key_t> tree;
+    WriteAheadLog<Key_t> log;
+    check(log.open(wal_dir.c_str(), options), "open log");
+    tree.set_wal(&log);
+    modify_concurrently(&tree, num_threads, 20000, 1, model);
+    auto before = list_files(wal_dir).size();
+    check(tree.checkpoint(path.c_str()), "checkpoint");
+    check(list_files(wal_dir).size() < before, "truncate covered segments");
+    modify_concurrently(&tree, num_threads, 20000, 2, model);
+    check(matches(tree, model), "tree before restart");
+  }
+
+  for (int restart = 0; restart < 2; restart++) {
+    BLinkTree<Key_t> tree;
+    WriteAheadLog<Key_t> log;
+    check(log.open(wal_dir.c_str(), options), "reopen log");
+    check(tree.recover(path.c_str(), &log, num_threads), "recover");
+    check(matches(tree, model),
+          "recovered tree, restart " + std::to_string(restart));
+    // logged after recovery, replayed by the next restart
+    modify_concurrently(&tree, num_threads, 5000, 3 + restart, model);
+  }
+
+  // without a checkpoint, the whole log is replayed
+  auto bare_dir = dir + "/wal_bare";
+  clear_dir(bare_dir);
+  Model bare;
+  {
+    BLinkTree<Key_t> tree;
+    WriteAheadLog<Key_t> log;
+    options.sync = WalSync::INTERVAL;
+    check(log.open(bare_dir.c_str(), options), "open log without checkpoint");
+    tree.set_wal(&log);
+    modify(&tree, 0, 20000, 5, bare);
+  }
+  BLinkTree<Key_t> tree;
+  WriteAheadLog<Key_t> log;
+  check(log.open(bare_dir.c_str(), options), "reopen log without checkpoint");
+  check(tree.recover((dir + "/missing.ckpt").c_str(), &log),
+        "recover without checkpoint");
+  check(matches(tree, bare), "tree recovered from log only");
+}
+
+/**
+ * @brief flip the bits of the byte at @p offset of the file at @p path .
+ */
+bool corrupt(const std::string& path, off_t offset) {
+  int fd = ::open(path.c_str(), O_RDWR);
+  uint8_t byte;
+  bool ok = (fd >= 0) && (::pread(fd, &byte, 1, offset) == 1);
+  byte ^= 0xff;
+  ok = ok && (::pwrite(fd, &byte, 1, offset) == 1);
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  return ok;
+}
+
+/**
+ * @brief save() and load() round trips of 64-bit keys and of 12 byte keys,
+ *        whose last block holds an odd number of them, an empty tree, and
+ *        files that load() must refuse, leaving the tree empty and usable.
+ */
+void check_checkpoint(const std::string& dir) {
+  auto path = dir + "/tree.ckpt";
+  Model model;
+  BLinkTree<Key_t> tree;
+  modify(&tree, 0, 50000, 6, model);
+  check(tree.save(path.c_str()), "save");
+  {
+    BLinkTree<Key_t> loaded;
+    check(loaded.load(path.c_str()), "load");
+    check(matches(loaded, model), "loaded tree");
+    check(!loaded.load(path.c_str()), "refuse loading into a non-empty tree");
+  }
+  check(tree.fuzzy_checkpoint(path.c_str()), "fuzzy checkpoint");
+  {
+    BLinkTree<Key_t> loaded;
+    check(loaded.load(path.c_str(), 2), "load fuzzy checkpoint");
+    check(matches(loaded, model), "tree loaded from fuzzy checkpoint");
+  }
+
+  using Fixed = FixedKey<12>;
+  std::map<Fixed, uint64_t> fixed_model;
+  BLinkTree<Fixed> fixed;
+  for (uint64_t i = 0; i < CHECKPOINT_BLOCK_ENTRIES + 3; i++) {
+    auto key = Fixed::from_string("key" + std::to_string(i * 7919));
+    fixed.upsert(key, i + 1);
+    fixed_model[key] = i + 1;
+  }
+  auto fixed_path = dir + "/fixed.ckpt";
+  check(fixed.save(fixed_path.c_str()), "save 12 byte keys");
+  {
+    BLinkTree<Fixed> loaded;
+    check(loaded.load(fixed_path.c_str()), "load 12 byte keys");
+    check(matches(loaded, fixed_model), "tree of 12 byte keys");
+  }
+
+  auto empty_path = dir + "/empty.ckpt";
+  {
+    BLinkTree<Key_t> empty, loaded;
+    check(empty.save(empty_path.c_str()), "save empty tree");
+    check(loaded.load(empty_path.c_str()), "load empty tree");
+    check(matches(loaded, Model()), "loaded empty tree");
+  }
+
+  auto refused = [](const std::string& path, const char* what) {
+    BLinkTree<Key_t> loaded;
+    check(!loaded.load(path.c_str()), what);
+    check(matches(loaded, Model()), std::string(what) + ", tree not empty");
+    loaded.upsert(1, 1);
+    check(loaded.lookup(1) == 1, std::string(what) + ", tree not usable");
+  };
+  refused(fixed_path, "refuse another key type");
+  refused(dir + "/missing.ckpt", "refuse a missing file");
+  // a key in the middle of the second block
+  check(corrupt(path, sizeof(CheckpointHeader) +
+                          checkpoint_block_size<Key_t>(
+                              CHECKPOINT_BLOCK_ENTRIES) +
+                          sizeof(CheckpointBlock) + 100),
+        "corrupt block");
+  refused(path, "refuse a corrupt block");
+  check(corrupt(empty_path, offsetof(CheckpointHeader, num_keys)),
+        "corrupt header");
+  refused(empty_path, "refuse a corrupt header");
+  check(tree.save(path.c_str()) && (::truncate(path.c_str(), 1000) == 0),
+        "truncate checkpoint");
+  refused(path, "refuse a truncated file");
+}
+
+int main(int argc, char* argv[]) {
+  std::string dir = argc > 1 ? argv[1] : "recovery_data";
+  int num_threads = argc > 2 ? atoi(argv[2]) : 4;
+  if ((::mkdir(dir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+    std::cerr << "cannot create " << dir << std::endl;
+    return 1;
+  }
+
+  check_wal(dir, num_threads);
+  check_checkpoint(dir);
+  std::cout << (failed ? "recovery checks failed"
+                       : "all recovery checks passed")
+            << std::endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+#ifndef RPC_H_
+#define RPC_H_
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define RPC_MAX_RANGE (1024)  // most values one RPC_RANGE response carries
+
+namespace BLINK_TREE {
+
+/**
+ * Binary protocol of server.cpp over a Unix domain stream socket, in host
+ * byte order since both ends run on one machine. A client may send any
+ * number of requests without waiting; responses come back in request order
+ * on each connection, tagged with the id of their request.
+ */
+enum RpcOp : uint8_t {
+  RPC_INSERT = 1,  // store arg for key, overwriting an existing value
+  RPC_LOOKUP = 2,  // value of key
+  RPC_UPDATE = 3,  // store arg for an existing key
+  RPC_REMOVE = 4,  // remove key
+  RPC_RANGE = 5,   // up to arg values of the keys not less than key
+};
+
+enum RpcStatus : uint8_t {
+  RPC_OK = 0,
+  RPC_NOT_FOUND = 1,
+  RPC_BAD_REQUEST = 2,
+};
+
+struct RpcRequest {
+  uint32_t id;  // chosen by the client, echoed in the response
+  uint8_t op;   // RpcOp
+  uint8_t pad[3];
+  uint64_t key;
+  // value of RPC_INSERT and RPC_UPDATE, count of RPC_RANGE. Value 0 stands
+  // for a missing key in the tree, so RPC_INSERT and RPC_UPDATE with it are
+  // answered RPC_BAD_REQUEST.
+  uint64_t arg;
+};
+
+/**
+ * Followed by count values: one for RPC_LOOKUP that found its key, the
+ * values found by RPC_RANGE, none otherwise.
+ */
+struct RpcResponse {
+  uint32_t id;
+  uint8_t status;  // RpcStatus
+  uint8_t pad[3];
+  uint32_t count;
+  uint32_t pad2;
+};
+
+static_assert(sizeof(RpcRequest) == 24, "RpcRequest is sent as is");
+static_assert(sizeof(RpcResponse) == 16, "RpcResponse is sent as is");
+
+/**
+ * @brief fill a sockaddr_un for @p path .
+ * @return false if @p path is too long
+ */
+inline bool rpc_address(const char* path, sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    return false;
+  }
+  strcpy(addr->sun_path, path);
+  return true;
+}
+
+/**
+ * Byte buffer of a connection: data is appended at the back and consumed
+ * from the front, the consumed prefix is dropped when the buffer is
+ * appended to again.
+ */
+class RpcBuffer {
+ public:
+  RpcBuffer() : head(0) {}
+
+  char* data() { return buf.data() + head; }
+
+  size_t size() const { return buf.size() - head; }
+
+  bool empty() const { return size() == 0; }
+
+  void consume(size_t len) {
+    head += len;
+    if (head == buf.size()) {
+      buf.clear();
+      head = 0;
+    }
+  }
+
+  /**
+   * @brief make room for @p len more bytes at the back.
+   * @return start of the room, valid until the next call
+   */
+  char* reserve(size_t len) {
+    if (head && (head >= buf.size() / 2)) {
+      buf.erase(buf.begin(), buf.begin() + head);
+      head = 0;
+    }
+    auto old = buf.size();
+    buf.resize(old + len);
+    return buf.data() + old;
+  }
+
+  /**
+   * @brief give back the part of the last reserve() that was not filled.
+   */
+  void unreserve(size_t len) { buf.resize(buf.size() - len); }
+
+  void append(const void* src, size_t len) {
+    memcpy(reserve(len), src, len);
+  }
+
+ private:
+  std::vector<char> buf;
+  size_t head;  // bytes consumed from the front
+};  // class RpcBuffer
+
+}  // namespace BLINK_TREE
+
+#endif  // RPC_H_
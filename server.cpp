@@ -0,0 +1,273 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "blinktree.h"
+#include "rpc.h"
+
+#define READ_CHUNK (64 * 1024)         // bytes read per read() call
+#define READ_LIMIT (256 * 1024)        // bytes read per readiness event
+#define OUTPUT_LIMIT (4 * 1024 * 1024)  // stop reading while more is unsent
+
+using Key_t = uint64_t;
+
+using namespace BLINK_TREE;
+
+static std::atomic<bool> stopping{false};
+static std::atomic<uint64_t> served{0};
+
+/**
+ * a client connection, owned by the I/O thread whose epoll set holds it
+ */
+struct Connection {
+  int fd;
+  uint32_t events;  // events the epoll set waits for
+  RpcBuffer in;
+  RpcBuffer out;
+};
+
+/**
+ * @brief append a response to @p out .
+ */
+void respond(RpcBuffer& out, uint32_t id, uint8_t status,
+             const uint64_t* values, uint32_t count) {
+  RpcResponse response;
+  memset(&response, 0, sizeof(response));
+  response.id = id;
+  response.status = status;
+  response.count = count;
+  auto dst = out.reserve(sizeof(response) + count * sizeof(uint64_t));
+  memcpy(dst, &response, sizeof(response));
+  memcpy(dst + sizeof(response), values, count * sizeof(uint64_t));
+}
+
+/**
+ * @brief serve the whole requests received on @p conn in order. A run of
+ *        lookups is answered by one multi_lookup() call, which reuses the
+ *        leaf of one key for the next ones. Value 0 means not found.
+ */
+void process(BLinkTree<Key_t>* tree, Connection* conn) {
+  static thread_local std::vector<Key_t> keys;
+  static thread_local std::vector<uint64_t> values;
+  uint64_t range_buf[RPC_MAX_RANGE];
+
+  int num = conn->in.size() / sizeof(RpcRequest);
+  auto reqs = conn->in.data();
+  auto request_at = [reqs](int i) {
+    RpcRequest request;
+    memcpy(&request, reqs + i * sizeof(RpcRequest), sizeof(request));
+    return request;
+  };
+
+  for (int i = 0; i < num;) {
+    auto request = request_at(i);
+    if (request.op == RPC_LOOKUP) {
+      int end = i;
+      keys.clear();
+      while ((end < num) && (request_at(end).op == RPC_LOOKUP)) {
+        keys.push_back(request_at(end++).key);
+      }
+      values.resize(keys.size());
+      tree->multi_lookup(keys.data(), keys.size(), values.data());
+      for (int j = i; j < end; j++) {
+        auto value = values[j - i];
+        respond(conn->out, request_at(j).id, value ? RPC_OK : RPC_NOT_FOUND,
+                &value, value ? 1 : 0);
+      }
+      i = end;
+      continue;
+    }
+
+    uint8_t status = RPC_OK;
+    uint32_t count = 0;
+    switch (request.op) {
+      case RPC_INSERT:
+        if (!request.arg) {
+          status = RPC_BAD_REQUEST;
+          break;
+        }
+        tree->upsert(request.key, request.arg);
+        break;
+      case RPC_UPDATE:
+        if (!request.arg) {
+          status = RPC_BAD_REQUEST;
+          break;
+        }
+        status = tree->update(request.key, request.arg) ? RPC_OK
+                                                        : RPC_NOT_FOUND;
+        break;
+      case RPC_REMOVE:
+        status = tree->remove(request.key) ? RPC_OK : RPC_NOT_FOUND;
+        break;
+      case RPC_RANGE:
+        count = tree->range_lookup(
+            request.key, std::min<uint64_t>(request.arg, RPC_MAX_RANGE),
+            range_buf);
+        break;
+      default:
+        status = RPC_BAD_REQUEST;
+    }
+    respond(conn->out, request.id, status, range_buf, count);
+    i++;
+  }
+  conn->in.consume(num * sizeof(RpcRequest));
+  served.fetch_add(num);
+}
+
+/**
+ * @brief read what @p conn received, up to READ_LIMIT bytes.
+ * @return false once the peer closed the connection or it failed
+ */
+bool receive(Connection* conn) {
+  for (size_t total = 0; total < READ_LIMIT;) {
+    auto dst = conn->in.reserve(READ_CHUNK);
+    auto ret = ::read(conn->fd, dst, READ_CHUNK);
+    conn->in.unreserve(READ_CHUNK - std::max<ssize_t>(ret, 0));
+    if (ret > 0) {
+      total += ret;
+      continue;
+    }
+    return (ret < 0) && ((errno == EAGAIN) || (errno == EINTR));
+  }
+  return true;
+}
+
+/**
+ * @brief write pending responses of @p conn until the socket is full.
+ * @return false if the connection failed
+ */
+bool send_pending(Connection* conn) {
+  while (!conn->out.empty()) {
+    auto ret = ::write(conn->fd, conn->out.data(), conn->out.size());
+    if (ret < 0) {
+      return (errno == EAGAIN) || (errno == EINTR);
+    }
+    conn->out.consume(ret);
+  }
+  return true;
+}
+
+/**
+ * @brief event loop of one I/O thread over the connections in @p epfd .
+ *        Requests are read as they arrive, so a client may pipeline any
+ *        number of them, and everything read is served before the
+ *        responses are written back together.
+ */
+void io_loop(BLinkTree<Key_t>* tree, int epfd) {
+  epoll_event events[64];
+  while (!stopping.load()) {
+    int num = ::epoll_wait(epfd, events, 64, 100);
+    for (int i = 0; i < num; i++) {
+      auto conn = static_cast<Connection*>(events[i].data.ptr);
+      bool alive = true;
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        alive = receive(conn);
+        process(tree, conn);
+      }
+      alive = send_pending(conn) && alive;
+      if (!alive) {
+        ::epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        ::close(conn->fd);
+        delete conn;
+        continue;
+      }
+
+      // a client that does not read its responses is not read from either
+      uint32_t wanted =
+          (conn->out.size() < OUTPUT_LIMIT) ? uint32_t(EPOLLIN) : 0;
+      if (!conn->out.empty()) {
+        wanted |= EPOLLOUT;
+      }
+      if (wanted != conn->events) {
+        conn->events = wanted;
+        epoll_event ev;
+        ev.events = wanted;
+        ev.data.ptr = conn;
+        ::epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+      }
+    }
+  }
+}
+
+void handle_signal(int) { stopping.store(true); }
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " socket_path [num_io_threads] [num_preload]" << std::endl;
+    exit(0);
+  }
+  const char* path = argv[1];
+  int num_threads = argc > 2 ? atoi(argv[2]) : 2;
+  uint64_t num_preload = argc > 3 ? atoll(argv[3]) : 0;
+
+  auto tree = new BLinkTree<Key_t>();
+  std::vector<Key_t> keys(num_preload);
+  for (uint64_t i = 0; i < num_preload; i++) {
+    keys[i] = i + 1;
+  }
+  tree->insert_batch(keys.data(), keys.data(), num_preload, true);
+  std::cout << "Preloaded " << num_preload << " keys, value = key"
+            << std::endl;
+
+  sockaddr_un addr;
+  if (!rpc_address(path, &addr)) {
+    std::cerr << "socket path too long" << std::endl;
+    exit(1);
+  }
+  int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  ::unlink(path);
+  if ((listen_fd < 0) ||
+      (::bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0) ||
+      (::listen(listen_fd, 128) != 0)) {
+    std::cerr << "cannot listen on " << path << ": " << strerror(errno)
+              << std::endl;
+    exit(1);
+  }
+
+  // accept() is interrupted rather than restarted by a signal
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_signal;
+  ::sigaction(SIGINT, &action, nullptr);
+  ::sigaction(SIGTERM, &action, nullptr);
+  ::signal(SIGPIPE, SIG_IGN);
+
+  std::vector<int> epfds;
+  std::vector<std::thread> io_threads;
+  for (int i = 0; i < num_threads; i++) {
+    epfds.push_back(::epoll_create1(0));
+    io_threads.emplace_back(io_loop, tree, epfds.back());
+  }
+  std::cout << "Listening on " << path << " with " << num_threads
+            << " I/O threads" << std::endl;
+
+  for (uint64_t next = 0; !stopping.load();) {
+    int fd = ::accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    auto conn = new Connection();
+    conn->fd = fd;
+    conn->events = EPOLLIN;
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    ::epoll_ctl(epfds[next++ % num_threads], EPOLL_CTL_ADD, fd, &ev);
+  }
+
+  for (auto& t : io_threads) {
+    t.join();
+  }
+  ::close(listen_fd);
+  ::unlink(path);
+  std::cout << "Served " << served.load() << " requests" << std::endl;
+  return 0;
+}
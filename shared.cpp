@@ -0,0 +1,151 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "blinktree.h"
+
+#if !PERSISTENT_TREE
+#error "shared.cpp maps a shared heap, build it with -DPERSISTENT_TREE=1"
+#endif
+
+using Key_t = uint64_t;
+
+using namespace BLINK_TREE;
+
+static bool failed = false;
+
+/**
+ * @brief report a failed check of @p what without stopping, so every check
+ *        runs and main() returns non-zero.
+ */
+void check(bool cond, const std::string& what) {
+  if (!cond) {
+    std::cout << "FAILED: " << what << std::endl;
+    failed = true;
+  }
+}
+
+/**
+ * @brief @p i th key of child @p child , children own disjoint keys that
+ *        interleave so they split and merge the same leaves.
+ */
+Key_t child_key(int child, int num_children, uint64_t i) {
+  return i * num_children + child + 1;
+}
+
+/**
+ * @brief whether child @p child removes its @p i th key again after
+ *        inserting it.
+ */
+bool removed(int child, uint64_t i) { return (i + child) % 3 == 0; }
+
+/**
+ * @brief attach to the shared tree once every child is started, insert the
+ *        keys of @p child in random order, remove a third of them and check
+ *        the own keys, which no other child touches.
+ * @return exit status, 0 if every own key is as expected
+ */
+int child(const std::string& name, int id, int num_children, uint64_t num_keys,
+          std::atomic<int>* started) {
+  started->fetch_add(1);
+  while (started->load() < num_children) {
+    usleep(100);
+  }
+  if (!PersistentHeap::open_shared(name.c_str())) {
+    return 2;
+  }
+  auto tree = new BLinkTree<Key_t>();
+  std::vector<uint64_t> order(num_keys);
+  for (uint64_t i = 0; i < num_keys; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937_64(id));
+  for (auto i : order) {
+    auto key = child_key(id, num_children, i);
+    tree->insert(key, key);
+  }
+  for (auto i : order) {
+    if (removed(id, i)) {
+      tree->remove(child_key(id, num_children, i));
+    }
+  }
+  int status = 0;
+  for (uint64_t i = 0; i < num_keys; i++) {
+    auto key = child_key(id, num_children, i);
+    if (tree->lookup(key) != (removed(id, i) ? 0 : key)) {
+      status = 1;
+    }
+  }
+  delete tree;
+  PersistentHeap::close();
+  return status;
+}
+
+int main(int argc, char* argv[]) {
+  int num_children = argc > 1 ? atoi(argv[1]) : 4;
+  uint64_t num_keys = argc > 2 ? atoll(argv[2]) : 100000;
+  std::string name = "/blinktree_shared_" + std::to_string(getpid());
+  auto started = static_cast<std::atomic<int>*>(
+      mmap(nullptr, sizeof(std::atomic<int>), PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+  if (started == MAP_FAILED) {
+    return 1;
+  }
+  new (started) std::atomic<int>(0);
+
+  // the children race to create the segment and the tree
+  std::vector<pid_t> pids;
+  for (int id = 0; id < num_children; id++) {
+    pid_t pid = fork();
+    if (!pid) {
+      _exit(child(name, id, num_children, num_keys, started));
+    }
+    pids.push_back(pid);
+  }
+  for (int id = 0; id < num_children; id++) {
+    int status;
+    waitpid(pids[id], &status, 0);
+    check(WIFEXITED(status) && !WEXITSTATUS(status),
+          "keys of child " + std::to_string(id));
+  }
+
+  std::vector<Key_t> expected;
+  for (uint64_t i = 0; i < num_keys; i++) {
+    for (int id = 0; id < num_children; id++) {
+      if (!removed(id, i)) {
+        expected.push_back(child_key(id, num_children, i));
+      }
+    }
+  }
+  if (!PersistentHeap::open_shared(name.c_str())) {
+    std::cerr << "cannot open " << name << std::endl;
+    PersistentHeap::unlink_shared(name.c_str());
+    return 1;
+  }
+  auto tree = new BLinkTree<Key_t>();
+  auto report = tree->verify();
+  check(report.ok, "verify: " + report.error);
+  check(report.num_keys == expected.size(),
+        "key count " + std::to_string(report.num_keys) + ", expected " +
+            std::to_string(expected.size()));
+  std::vector<uint64_t> values(expected.size() + 1);
+  int found = tree->range_lookup(1, values.size(), values.data());
+  values.resize(found);
+  check(values == expected, "scan of all keys");
+  std::cout << num_children << " processes, " << expected.size()
+            << " keys, height " << tree->height() << std::endl;
+  delete tree;
+  PersistentHeap::close();
+  check(PersistentHeap::unlink_shared(name.c_str()), "unlink " + name);
+
+  std::cout << (failed ? "shared checks failed" : "all shared checks passed")
+            << std::endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,669 @@
+// small nodes split, and grow a new root, every few dozen keys
+#define PAGE_SIZE (256)
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "blinktree.h"
+
+using Key_t = uint64_t;
+
+using namespace BLINK_TREE;
+
+enum OpType : uint8_t {
+  OP_LOOKUP,            // out: value, 0 if absent
+  OP_RANGE,             // out: one value returned by range_lookup()
+  OP_UPSERT,            // arg: value; ok: inserted
+  OP_INSERT_IF_ABSENT,  // arg: value; ok: inserted, out: existing value
+  OP_UPDATE,            // arg: value; ok: updated
+  OP_REMOVE,            // ok: removed
+  OP_CAS,               // arg: desired, expected; ok: replaced, out: stored
+  OP_CLEAR,             // removed by remove_range(), result per key unknown
+};
+
+/**
+ * one operation on one key, with the logical times of its call and return.
+ * A range lookup is recorded as one OP_RANGE per value it returned, whose
+ * key is resolved from the value after the run, and remove_range() as one
+ * OP_CLEAR per key of its range.
+ */
+struct Op {
+  uint64_t call;
+  uint64_t ret;
+  Key_t key;
+  OpType type;
+  bool ok;
+  uint64_t arg;
+  uint64_t expected;
+  uint64_t out;
+};
+
+static std::atomic<uint64_t> logical_clock{0};
+
+/**
+ * @brief apply @p op to the value of one key, 0 meaning absent.
+ * @return whether @p op returns what it returned when applied to @p value
+ */
+bool apply(const Op& op, uint64_t& value) {
+  switch (op.type) {
+    case OP_LOOKUP:
+    case OP_RANGE:
+      return op.out == value;
+    case OP_UPSERT:
+      if (op.ok != !value) return false;
+      value = op.arg;
+      return true;
+    case OP_INSERT_IF_ABSENT:
+      if (op.ok != !value) return false;
+      if (op.ok) {
+        value = op.arg;
+        return true;
+      }
+      return op.out == value;
+    case OP_UPDATE:
+      if (op.ok != (value != 0)) return false;
+      if (op.ok) value = op.arg;
+      return true;
+    case OP_REMOVE:
+      if (op.ok != (value != 0)) return false;
+      value = 0;
+      return true;
+    case OP_CAS:
+      if (value && (value == op.expected)) {
+        value = op.arg;
+        return op.ok;
+      }
+      return !op.ok && (op.out == value);
+    case OP_CLEAR:
+      value = 0;
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief whether the history @p ops of one key, starting absent, is
+ *        linearizable: some order of the operations that respects their
+ *        real time order returns what every operation returned. Depth first
+ *        search of Wing and Gong, pruned by the cache of Lowe, over the call
+ *        and return events in time order.
+ */
+bool linearizable(const std::vector<const Op*>& ops) {
+  struct Event {
+    uint64_t time;
+    int op;
+    bool call;
+    int match;  // index of the return event of a call
+    int prev;
+    int next;
+  };
+  int num = ops.size();
+  std::vector<Event> events;
+  for (int i = 0; i < num; i++) {
+    events.push_back({ops[i]->call, i, true, -1, -1, -1});
+    events.push_back({ops[i]->ret, i, false, -1, -1, -1});
+  }
+  std::sort(events.begin(), events.end(),
+            [](const Event& a, const Event& b) { return a.time < b.time; });
+  std::vector<int> ret_of(num);
+  for (int i = 0; i < 2 * num; i++) {
+    events[i].prev = i - 1;
+    events[i].next = (i + 1 < 2 * num) ? i + 1 : -1;
+    if (!events[i].call) {
+      ret_of[events[i].op] = i;
+    }
+  }
+  for (auto& event : events) {
+    if (event.call) {
+      event.match = ret_of[event.op];
+    }
+  }
+
+  // the list starts after a sentinel, lifting unlinks a call and its return
+  int head = num ? 0 : -1;
+  auto unlink = [&](int i) {
+    if (events[i].prev >= 0) {
+      events[events[i].prev].next = events[i].next;
+    } else {
+      head = events[i].next;
+    }
+    if (events[i].next >= 0) {
+      events[events[i].next].prev = events[i].prev;
+    }
+  };
+  auto relink = [&](int i) {
+    if (events[i].prev >= 0) {
+      events[events[i].prev].next = i;
+    } else {
+      head = i;
+    }
+    if (events[i].next >= 0) {
+      events[events[i].next].prev = i;
+    }
+  };
+
+  struct State {
+    std::vector<uint64_t> done;  // bitset of linearized operations
+    uint64_t value;
+    bool operator==(const State& other) const {
+      return (value == other.value) && (done == other.done);
+    }
+  };
+  struct StateHash {
+    size_t operator()(const State& state) const {
+      size_t h = std::hash<uint64_t>{}(state.value);
+      for (auto word : state.done) {
+        h = h * 31 + std::hash<uint64_t>{}(word);
+      }
+      return h;
+    }
+  };
+  std::unordered_set<State, StateHash> cache;
+  std::vector<std::pair<int, uint64_t>> stack;  // lifted call, value before
+  State state{std::vector<uint64_t>((num + 63) / 64, 0), 0};
+
+  int entry = head;
+  while (head >= 0) {
+    if (entry < 0) {
+      return false;
+    }
+    auto& event = events[entry];
+    if (event.call) {
+      uint64_t value = state.value;
+      if (apply(*ops[event.op], value)) {
+        State next = state;
+        next.done[event.op / 64] |= 1ull << (event.op % 64);
+        next.value = value;
+        if (cache.insert(next).second) {
+          stack.emplace_back(entry, state.value);
+          state = std::move(next);
+          unlink(entry);
+          unlink(event.match);
+          entry = head;
+          continue;
+        }
+      }
+      entry = event.next;
+    } else {
+      // the earliest pending operation returned before any order fit
+      if (stack.empty()) {
+        return false;
+      }
+      auto [call, value] = stack.back();
+      stack.pop_back();
+      relink(events[call].match);
+      relink(call);
+      state.done[events[call].op / 64] &= ~(1ull << (events[call].op % 64));
+      state.value = value;
+      entry = events[call].next;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief run @p num_ops random operations of thread @p tid on keys in
+ *        [1, @p key_range ], recording them in @p history . Written values
+ *        are unique, so a read tells which write it observed.
+ */
+void run_thread(BLinkTree<Key_t>* tree, int tid, int num_ops,
+                uint64_t key_range, uint64_t seed, std::vector<Op>& history) {
+  std::mt19937_64 rng(seed);
+  std::unordered_map<Key_t, uint64_t> seen;  // last value seen per key
+  uint64_t next_value = ((uint64_t)(tid + 1) << 40) + 1;
+  uint64_t buf[16];
+
+  for (int i = 0; i < num_ops; i++) {
+    Op op;
+    memset(&op, 0, sizeof(op));
+    op.key = rng() % key_range + 1;
+    op.arg = next_value++;
+    int dice = rng() % 100;
+    op.call = logical_clock.fetch_add(1);
+    if (dice < 15) {
+      op.type = OP_LOOKUP;
+      op.out = tree->lookup(op.key);
+    } else if (dice < 25) {
+      op.type = OP_LOOKUP;
+      op.out = tree->lookup_cached(op.key);
+    } else if (dice < 35) {
+      int num = tree->range_lookup(op.key, 1 + rng() % 16, buf);
+      op.ret = logical_clock.fetch_add(1);
+      op.type = OP_RANGE;
+      for (int j = 0; j < num; j++) {
+        op.out = buf[j];
+        op.ok = j == 0;  // marks the first value of a range
+        history.push_back(op);
+      }
+      continue;
+    } else if (dice < 50) {
+      op.type = OP_UPSERT;
+      op.ok = tree->upsert(op.key, op.arg);
+    } else if (dice < 62) {
+      op.type = OP_INSERT_IF_ABSENT;
+      op.ok = tree->insert_if_absent(op.key, op.arg, &op.out);
+    } else if (dice < 72) {
+      op.type = OP_UPDATE;
+      op.ok = tree->update(op.key, op.arg);
+    } else if (dice < 85) {
+      op.type = OP_REMOVE;
+      op.ok = tree->remove(op.key);
+    } else if (dice < 97) {
+      op.type = OP_CAS;
+      auto it = seen.find(op.key);
+      op.expected = (it != seen.end()) ? it->second : 0;
+      op.out = op.expected;
+      op.ok = tree->compare_exchange(op.key, op.out, op.arg);
+      if (op.ok) {
+        op.out = 0;
+      }
+    } else {
+      // merges emptied leaves with their neighbours
+      auto high = op.key + 1 + rng() % 8;
+      tree->remove_range(op.key, high);
+      op.ret = logical_clock.fetch_add(1);
+      op.type = OP_CLEAR;
+      for (auto key = op.key; key < high; key++) {
+        op.key = key;
+        history.push_back(op);
+      }
+      continue;
+    }
+    op.ret = logical_clock.fetch_add(1);
+    // the value a later compare_exchange() of this thread expects
+    if ((op.type == OP_UPSERT) || op.ok) {
+      seen[op.key] = (op.type == OP_REMOVE) ? 0 : op.arg;
+    } else {
+      seen[op.key] = op.out;  // 0 after a failed update() or remove()
+    }
+    history.push_back(op);
+  }
+}
+
+/**
+ * @brief take snapshots while the writers of a round run, until @p done .
+ *        Through each one, two scans of all keys by range_lookup() must
+ *        return the same values, and those of lookup() of every key in key
+ *        order. Writers keep versioning leaves while a snapshot is held.
+ * @param[out] error first mismatch found, empty if none
+ * @param[out] num_snapshots snapshots checked
+ */
+void run_snapshots(BLinkTree<Key_t>* tree, uint64_t key_range,
+                   const std::atomic<bool>& done, std::string& error,
+                   uint64_t& num_snapshots) {
+  int range = key_range + 8;
+  std::vector<uint64_t> first(range), second(range), looked_up;
+  do {
+    auto snapshot = tree->snapshot();
+    first.resize(snapshot.range_lookup(1, range, first.data()));
+    looked_up.clear();
+    for (Key_t key = 1; key <= (Key_t)range; key++) {
+      if (auto value = snapshot.lookup(key)) {
+        looked_up.push_back(value);
+      }
+    }
+    second.resize(range);
+    second.resize(snapshot.range_lookup(1, range, second.data()));
+    if (first != second) {
+      error = "two scans of one snapshot differ";
+    } else if (first != looked_up) {
+      error = "scan of a snapshot returned " + std::to_string(first.size()) +
+              " values, its lookups " + std::to_string(looked_up.size());
+    }
+    first.resize(range);
+    num_snapshots++;
+  } while (!done && error.empty());
+}
+
+#if ORDER_STATS
+/**
+ * @brief rank(), select() and count_range() of the quiescent @p tree against
+ *        @p keys , the sorted keys it holds, after round @p round .
+ */
+bool check_order_stats(BLinkTree<Key_t>* tree, int round,
+                       const std::vector<Key_t>& keys, uint64_t key_range) {
+  auto fail = [round](const std::string& what) {
+    std::cout << "round " << round << ": " << what << std::endl;
+    return false;
+  };
+  for (Key_t key = 0; key <= key_range + 9; key++) {
+    uint64_t expected =
+        std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+    if (tree->rank(key) != expected) {
+      return fail("rank of key " + std::to_string(key) + " is " +
+                  std::to_string(tree->rank(key)) + ", expected " +
+                  std::to_string(expected));
+    }
+  }
+  Key_t key;
+  for (uint64_t i = 0; i < keys.size(); i++) {
+    if (!tree->select(i, key) || (key != keys[i])) {
+      return fail("select of rank " + std::to_string(i) + " is wrong");
+    }
+  }
+  if (tree->select(keys.size(), key)) {
+    return fail("select beyond the last key found a key");
+  }
+  std::mt19937_64 rng(round);
+  for (int i = 0; i < 1000; i++) {
+    Key_t low = rng() % (key_range + 10);
+    Key_t high = rng() % (key_range + 10);
+    uint64_t expected =
+        (low < high) ? std::lower_bound(keys.begin(), keys.end(), high) -
+                           std::lower_bound(keys.begin(), keys.end(), low)
+                     : 0;
+    if (tree->count_range(low, high) != expected) {
+      return fail("count_range of [" + std::to_string(low) + ", " +
+                  std::to_string(high) + ") is wrong");
+    }
+  }
+  return true;
+}
+#endif
+
+/**
+ * @brief one round on a new tree: concurrent operations and snapshot reads,
+ *        a final lookup of every key, verify() and a linearizability check
+ *        per key. With ORDER_STATS, also rank(), select() and count_range()
+ *        of the final keys.
+ * @return false on the first violation found
+ */
+bool run_round(int round, int num_threads, int num_ops, uint64_t key_range) {
+  auto tree = new BLinkTree<Key_t>();
+  std::vector<std::vector<Op>> histories(num_threads + 1);
+  std::vector<std::thread> threads;
+  for (int tid = 0; tid < num_threads; tid++) {
+    threads.emplace_back(run_thread, tree, tid, num_ops, key_range,
+                         (uint64_t)round * 1000 + tid, std::ref(histories[tid]));
+  }
+  std::atomic<bool> done{false};
+  std::string snapshot_error;
+  uint64_t num_snapshots = 0;
+  std::thread snapshots(run_snapshots, tree, key_range, std::cref(done),
+                        std::ref(snapshot_error), std::ref(num_snapshots));
+  for (auto& t : threads) {
+    t.join();
+  }
+  done = true;
+  snapshots.join();
+  if (!snapshot_error.empty()) {
+    std::cout << "round " << round << ": " << snapshot_error << std::endl;
+    return false;
+  }
+
+  auto report = tree->verify();
+  if (!report.ok) {
+    std::cout << "round " << round << ": verify failed: " << report.error
+              << std::endl;
+    return false;
+  }
+  auto& final_reads = histories[num_threads];
+  for (Key_t key = 1; key <= key_range + 8; key++) {
+    Op op;
+    memset(&op, 0, sizeof(op));
+    op.call = logical_clock.fetch_add(1);
+    op.key = key;
+    op.type = OP_LOOKUP;
+    op.out = tree->lookup(key);
+    op.ret = logical_clock.fetch_add(1);
+    final_reads.push_back(op);
+  }
+#if ORDER_STATS
+  std::vector<Key_t> present;
+  for (auto& op : final_reads) {
+    if (op.out) {
+      present.push_back(op.key);
+    }
+  }
+  if (!check_order_stats(tree, round, present, key_range)) {
+    return false;
+  }
+#endif
+
+  // resolve the keys of range lookups from the values written
+  std::unordered_map<uint64_t, Key_t> key_of;
+  for (auto& history : histories) {
+    for (auto& op : history) {
+      if ((op.type != OP_LOOKUP) && (op.type != OP_RANGE) &&
+          (op.type != OP_REMOVE) && (op.type != OP_CLEAR)) {
+        key_of[op.arg] = op.key;
+      }
+    }
+  }
+  std::unordered_map<Key_t, std::vector<const Op*>> per_key;
+  for (int tid = 0; tid < num_threads; tid++) {
+    Key_t prev_key = 0;
+    for (auto& op : histories[tid]) {
+      if (op.type == OP_RANGE) {
+        // the values of a range lookup belong to increasing keys from op.key
+        auto it = key_of.find(op.out);
+        if (it == key_of.end()) {
+          std::cout << "round " << round << ": range returned unwritten value "
+                    << op.out << std::endl;
+          return false;
+        }
+        if ((it->second < op.key) || (!op.ok && (it->second <= prev_key))) {
+          std::cout << "round " << round << ": range from key " << op.key
+                    << " out of order at key " << it->second << std::endl;
+          return false;
+        }
+        prev_key = it->second;
+        op.key = it->second;
+      }
+    }
+    for (auto& op : histories[tid]) {
+      per_key[op.key].push_back(&op);
+    }
+  }
+  for (auto& op : final_reads) {
+    per_key[op.key].push_back(&op);
+  }
+
+  uint64_t num_checked = 0;
+  for (auto& [key, ops] : per_key) {
+    if (!linearizable(ops)) {
+      std::cout << "round " << round << ": history of key " << key
+                << " is not linearizable (" << ops.size() << " operations)"
+                << std::endl;
+      return false;
+    }
+    num_checked += ops.size();
+  }
+  std::cout << "round " << round << ": " << num_checked
+            << " operations linearizable, height " << report.height
+            << ", keys " << report.num_keys << ", " << num_snapshots
+            << " snapshots consistent" << std::endl;
+  delete tree;
+  return true;
+}
+
+/**
+ * @brief whether @p tree passes verify() and holds exactly the pairs of
+ *        @p model , reporting the first difference as a failure of @p what .
+ */
+bool matches(BLinkTree<Key_t>* tree, const std::map<Key_t, uint64_t>& model,
+             const char* what) {
+  auto report = tree->verify();
+  if (!report.ok) {
+    std::cout << what << ": verify failed: " << report.error << std::endl;
+    return false;
+  }
+  if (report.num_keys != model.size()) {
+    std::cout << what << ": " << report.num_keys << " keys, expected "
+              << model.size() << std::endl;
+    return false;
+  }
+  for (auto& [key, value] : model) {
+    if (tree->lookup(key) != value) {
+      std::cout << what << ": wrong value of key " << key << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief append() of ascending keys, which fills leaves completely, then of
+ *        keys below the rightmost leaf, which fall back to insert(), then
+ *        ascending again.
+ */
+bool check_append() {
+  auto tree = new BLinkTree<Key_t>();
+  std::map<Key_t, uint64_t> model;
+  std::mt19937_64 rng(1);
+  for (Key_t key = 2; key <= 20000; key += 2) {
+    tree->append(key, key);
+    model[key] = key;
+  }
+  if (!matches(tree, model, "ascending append")) {
+    return false;
+  }
+  auto full = tree->verify().fill[0];
+  // like insert(), append() does not check for existing keys
+  for (int i = 0; i < 2000; i++) {
+    Key_t key = rng() % 20000 / 2 * 2 + 1;
+    if (model.emplace(key, key + 1).second) {
+      tree->append(key, key + 1);
+    }
+  }
+  for (Key_t key = 20002; key <= 30000; key += 2) {
+    tree->append(key, key);
+    model[key] = key;
+  }
+  if (!matches(tree, model, "append out of order")) {
+    return false;
+  }
+  // split() leaves at least half of a leaf behind
+  auto mixed = tree->verify().fill[0];
+  if ((full < 0.95) || (mixed < 0.5)) {
+    std::cout << "append: leaf fill " << full << " after ascending keys, "
+              << mixed << " after keys out of order" << std::endl;
+    return false;
+  }
+  std::cout << "append: " << model.size() << " keys, leaf fill " << full
+            << " ascending, " << mixed << " mixed" << std::endl;
+  delete tree;
+  return true;
+}
+
+/**
+ * @brief unsorted insert_batch() calls whose keys repeat within a batch and
+ *        across batches. Like insert(), every pair is stored, so keys occur
+ *        as often as they were inserted and lookup() finds one of their values.
+ */
+bool check_insert_batch() {
+  auto tree = new BLinkTree<Key_t>();
+  std::map<Key_t, std::vector<uint64_t>> model;
+  std::mt19937_64 rng(2);
+  uint64_t num_pairs = 0;
+  uint64_t next_value = 1;
+  for (int batch = 0; batch < 20; batch++) {
+    int num = 1 + rng() % 2000;
+    // runs of one key longer than a leaf and than the children of a node
+    Key_t key_range = (batch % 4) ? 5000 : 8;
+    std::vector<Key_t> keys(num);
+    std::vector<uint64_t> values(num);
+    for (int i = 0; i < num; i++) {
+      keys[i] = rng() % key_range + 1;
+      values[i] = next_value++;
+      model[keys[i]].push_back(values[i]);
+    }
+    tree->insert_batch(keys.data(), values.data(), num);
+    num_pairs += num;
+  }
+
+  auto report = tree->verify(false, false);
+  if (!report.ok) {
+    std::cout << "insert_batch: verify failed: " << report.error << std::endl;
+    return false;
+  }
+  if ((report.num_keys != num_pairs) ||
+      (report.duplicate_keys != num_pairs - model.size())) {
+    std::cout << "insert_batch: " << report.num_keys << " keys, "
+              << report.duplicate_keys << " duplicates, expected " << num_pairs
+              << ", " << num_pairs - model.size() << std::endl;
+    return false;
+  }
+  for (auto& [key, values] : model) {
+    auto value = tree->lookup(key);
+    if (std::find(values.begin(), values.end(), value) == values.end()) {
+      std::cout << "insert_batch: wrong value of key " << key << std::endl;
+      return false;
+    }
+  }
+  std::cout << "insert_batch: " << num_pairs << " pairs, " << model.size()
+            << " distinct keys" << std::endl;
+  delete tree;
+  return true;
+}
+
+/**
+ * @brief parallel_multi_lookup() of unsorted probes, present, removed and
+ *        repeated keys, against lookup() for several thread counts and probe
+ *        counts, including fewer probes than threads.
+ */
+bool check_parallel_multi_lookup() {
+  auto tree = new BLinkTree<Key_t>();
+  std::mt19937_64 rng(3);
+  for (Key_t key = 1; key <= 20000; key++) {
+    tree->upsert(key * 3, key);
+  }
+  for (int i = 0; i < 2000; i++) {
+    tree->remove(rng() % 20000 * 3 + 3);
+  }
+  for (int num : {0, 1, 3, 7, 100, 10000}) {
+    std::vector<Key_t> keys(num);
+    for (auto& key : keys) {
+      key = rng() % 61000;
+    }
+    for (int num_threads : {1, 2, 4, 8}) {
+      std::vector<uint64_t> values(num, UINT64_MAX);
+      tree->parallel_multi_lookup(keys.data(), num, values.data(),
+                                  num_threads);
+      for (int i = 0; i < num; i++) {
+        if (values[i] != tree->lookup(keys[i])) {
+          std::cout << "parallel_multi_lookup: " << num << " probes, "
+                    << num_threads << " threads: wrong value of key "
+                    << keys[i] << std::endl;
+          return false;
+        }
+      }
+    }
+  }
+  std::cout << "parallel_multi_lookup: probes match lookup()" << std::endl;
+  delete tree;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " num_rounds [num_threads] [ops_per_thread] [key_range]"
+              << std::endl;
+    exit(0);
+  }
+  int num_rounds = atoi(argv[1]);
+  int num_threads = argc > 2 ? atoi(argv[2]) : 4;
+  int num_ops = argc > 3 ? atoi(argv[3]) : 20000;
+  uint64_t key_range = argc > 4 ? atoll(argv[4]) : 2000;
+
+  for (int round = 0; round < num_rounds; round++) {
+    if (!run_round(round, num_threads, num_ops, key_range)) {
+      return 1;
+    }
+  }
+  if (!check_append() || !check_insert_batch() ||
+      !check_parallel_multi_lookup()) {
+    return 1;
+  }
+  std::cout << "all rounds passed" << std::endl;
+  return 0;
+}
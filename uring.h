@@ -0,0 +1,276 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING (1)
+#else
+#define HAVE_IO_URING (0)
+#endif
+
+#define ASYNC_QUEUE_DEPTH (64)  // reads in flight of one async lookup batch
+
+namespace BLINK_TREE {
+
+/**
+ * Minimal io_uring for batched file reads, driven through the raw system
+ * calls so no library is needed. Reads are queued with read(), handed to the
+ * kernel together by submit() and their completions are consumed by reap().
+ * Where io_uring is unavailable, e.g. an old kernel or a seccomp filter, the
+ * ring falls back to pread() at queue time and reap() reports the results,
+ * so callers are written once for both.
+ */
+class IoRing {
+ public:
+  IoRing() : ring_fd(-1), entries(0), queued(0), inflight(0) {}
+
+  ~IoRing() { close(); }
+
+  IoRing(const IoRing&) = delete;
+  IoRing& operator=(const IoRing&) = delete;
+
+  /**
+   * @brief set up a ring of at least @p _entries submission entries.
+   * @return false if the pread() fallback is used
+   */
+  bool init(unsigned _entries) {
+    close();
+    entries = _entries;
+#if HAVE_IO_URING
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)::syscall(__NR_io_uring_setup, _entries, &params);
+    if (fd < 0) {
+      return false;
+    }
+
+    size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_len =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      sq_len = cq_len = std::max(sq_len, cq_len);
+    }
+    auto sq = ::mmap(nullptr, sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    auto cq = sq;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+      cq = ::mmap(nullptr, cq_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq == MAP_FAILED) {
+        ::munmap(sq, sq_len);
+        ::close(fd);
+        return false;
+      }
+    }
+    auto sqes = ::mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe),
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                       IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      if (cq != sq) {
+        ::munmap(cq, cq_len);
+      }
+      ::munmap(sq, sq_len);
+      ::close(fd);
+      return false;
+    }
+
+    ring_fd = fd;
+    entries = params.sq_entries;
+    sq_ring = {static_cast<char*>(sq), sq_len};
+    cq_ring = {static_cast<char*>(cq), cq_len};
+    sqe_ring = {static_cast<char*>(sqes),
+                params.sq_entries * sizeof(io_uring_sqe)};
+    auto sq_ptr = static_cast<char*>(sq);
+    sq_tail = reinterpret_cast<std::atomic<unsigned>*>(sq_ptr +
+                                                       params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.array);
+    auto cq_ptr = static_cast<char*>(cq);
+    cq_head = reinterpret_cast<std::atomic<unsigned>*>(cq_ptr +
+                                                       params.cq_off.head);
+    cq_tail = reinterpret_cast<std::atomic<unsigned>*>(cq_ptr +
+                                                       params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq_ptr + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq_ptr + params.cq_off.cqes);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief true if reads go through io_uring rather than pread().
+   */
+  bool kernel_backed() const { return ring_fd >= 0; }
+
+  /**
+   * @brief submission entries of the ring, 0 before init().
+   */
+  unsigned capacity() const { return entries; }
+
+  /**
+   * @brief queue a read of @p len bytes at @p offset of @p fd into @p buf ,
+   *        reported to reap() with @p user_data . The caller keeps at most
+   *        the number of entries passed to init() outstanding.
+   */
+  void read(int fd, void* buf, uint32_t len, uint64_t offset,
+            uint64_t user_data) {
+#if HAVE_IO_URING
+    if (ring_fd >= 0) {
+      auto tail = sq_tail->load(std::memory_order_relaxed);
+      auto idx = tail & sq_mask;
+      auto sqe = reinterpret_cast<io_uring_sqe*>(sqe_ring.addr) + idx;
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = fd;
+      sqe->addr = reinterpret_cast<uint64_t>(buf);
+      sqe->len = len;
+      sqe->off = offset;
+      sqe->user_data = user_data;
+      sq_array[idx] = idx;
+      // publish the entry before the kernel can see the new tail
+      sq_tail->store(tail + 1, std::memory_order_release);
+      queued++;
+      inflight++;
+      return;
+    }
+#endif
+    done.push_back({user_data, (int64_t)::pread(fd, buf, len, offset)});
+  }
+
+  /**
+   * @brief hand all queued reads to the kernel in one system call.
+   */
+  void submit() { enter(0); }
+
+  /**
+   * @brief submit queued reads and block until at least one read completed.
+   *        Returns at once if no read is outstanding.
+   */
+  void wait() {
+    if (done.empty() && inflight) {
+      enter(1);
+    }
+  }
+
+  /**
+   * @brief consume completed reads, calling @p fn (user_data, result) for
+   *        each, result is the number of bytes read or a negative errno.
+   * @return number of completions consumed
+   */
+  template <typename F>
+  int reap(F&& fn) {
+    int cnt = 0;
+    for (auto& completion : done) {
+      fn(completion.user_data, completion.result);
+      cnt++;
+    }
+    done.clear();
+#if HAVE_IO_URING
+    if (ring_fd >= 0) {
+      auto head = cq_head->load(std::memory_order_relaxed);
+      auto tail = cq_tail->load(std::memory_order_acquire);
+      for (; head != tail; head++, cnt++) {
+        auto& cqe = cqes[head & cq_mask];
+        inflight--;
+        fn(cqe.user_data, (int64_t)cqe.res);
+      }
+      cq_head->store(head, std::memory_order_release);
+    }
+#endif
+    return cnt;
+  }
+
+  /**
+   * @brief number of queued reads whose completion was not reaped yet.
+   */
+  unsigned pending() const { return inflight + done.size(); }
+
+  void close() {
+#if HAVE_IO_URING
+    if (ring_fd >= 0) {
+      if (cq_ring.addr != sq_ring.addr) {
+        ::munmap(cq_ring.addr, cq_ring.len);
+      }
+      ::munmap(sq_ring.addr, sq_ring.len);
+      ::munmap(sqe_ring.addr, sqe_ring.len);
+      ::close(ring_fd);
+      ring_fd = -1;
+    }
+#endif
+    queued = inflight = 0;
+    done.clear();
+  }
+
+ private:
+  struct Completion {
+    uint64_t user_data;
+    int64_t result;
+  };
+
+  struct Mapping {
+    char* addr;
+    size_t len;
+  };
+
+  void enter(unsigned min_complete) {
+#if HAVE_IO_URING
+    if ((ring_fd < 0) || (!queued && !min_complete)) {
+      return;
+    }
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+      int ret = (int)::syscall(__NR_io_uring_enter, ring_fd, queued,
+                               min_complete, flags, nullptr, 0);
+      if (ret >= 0) {
+        queued -= std::min<unsigned>(queued, ret);
+        if (!queued || !min_complete) {
+          return;
+        }
+      } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        return;
+      }
+    }
+#else
+    (void)min_complete;
+#endif
+  }
+
+  int ring_fd;
+  unsigned entries;
+  unsigned queued;    // entries not submitted yet
+  unsigned inflight;  // entries submitted or queued, not reaped
+  std::vector<Completion> done;  // results of the pread() fallback
+
+#if HAVE_IO_URING
+  Mapping sq_ring;
+  Mapping cq_ring;
+  Mapping sqe_ring;
+  std::atomic<unsigned>* sq_tail;
+  unsigned sq_mask;
+  unsigned* sq_array;
+  std::atomic<unsigned>* cq_head;
+  std::atomic<unsigned>* cq_tail;
+  unsigned cq_mask;
+  io_uring_cqe* cqes;
+#endif
+};  // class IoRing
+
+}  // namespace BLINK_TREE
+
+#endif  // URING_H_
@@ -0,0 +1,404 @@
+#ifndef WAL_H_
+#define WAL_H_
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "checkpoint.h"
+#include "epoch.h"
+
+namespace BLINK_TREE {
+
+/**
+ * When appended records are made durable.
+ */
+enum class WalSync {
+  COMMIT,    // an operation returns once its record is fsynced, concurrent
+             // operations share one fsync (group commit)
+  INTERVAL,  // records are written and fsynced every flush interval, an
+             // operation may be lost within that interval after a crash
+  NONE       // records are written every flush interval, never fsynced
+};
+
+struct WalOptions {
+  WalSync sync = WalSync::COMMIT;
+  uint64_t flush_interval_us = 1000;
+  uint64_t segment_bytes = 64ull << 20;  // segment size before rotation
+};
+
+/**
+ * Record types. Records describe the result of an operation on its leaf, so
+ * replaying a record that is already reflected in a checkpoint is harmless.
+ */
+enum WalType : uint8_t {
+  WAL_PUT = 1,        // key holds value
+  WAL_DEL = 2,        // one instance of key is removed
+  WAL_DEL_RANGE = 3,  // keys within [key, high_key] are removed
+};
+
+struct WalRecordHeader {
+  uint32_t crc;  // crc32c of the rest of header and payload
+  uint8_t type;
+  uint8_t pad[3];
+  uint64_t seq;
+};
+
+template <typename key_t>
+struct WalRecord {
+  uint64_t seq;
+  uint8_t type;
+  key_t key;
+  key_t high_key;  // WAL_DEL_RANGE only
+  uint64_t value;  // WAL_PUT only
+};
+
+/**
+ * Write-ahead log of a BLinkTree, stored as segment files wal.<index> in a
+ * directory. Every record gets a sequence number when it is appended, which
+ * happens while the operation holds its leaf write lock, so records of the
+ * same key are numbered in the order they were applied. Records are appended
+ * to per-thread buffers and written out by a background flusher.
+ */
+template <typename key_t>
+class WriteAheadLog {
+ public:
+  WriteAheadLog()
+      : fd(-1),
+        segment_size(0),
+        next_seq(1),
+        started_round(0),
+        completed_round(0),
+        flush_requested(false),
+        stopped(false) {}
+
+  ~WriteAheadLog() { close(); }
+
+  /**
+   * @brief open the log in directory @p _dir , created if missing. Existing
+   *        segments are kept for read_records(), new records go to a new
+   *        segment and continue their sequence numbers.
+   */
+  bool open(const char* _dir, const WalOptions& _options = WalOptions()) {
+    dir = _dir;
+    options = _options;
+    ::mkdir(dir.c_str(), 0755);
+
+    auto dp = ::opendir(dir.c_str());
+    if (!dp) {
+      return false;
+    }
+    while (auto ent = ::readdir(dp)) {
+      uint64_t index;
+      char tail;
+      if (sscanf(ent->d_name, "wal.%lu%c", &index, &tail) == 1) {
+        segments.push_back({index, 0});
+      }
+    }
+    ::closedir(dp);
+    std::sort(segments.begin(), segments.end(),
+              [](const Segment& a, const Segment& b) {
+                return a.index < b.index;
+              });
+
+    for (auto& segment : segments) {
+      read_segment(segment, [&](const WalRecord<key_t>& record) {
+        segment.max_seq = std::max(segment.max_seq, record.seq);
+      });
+      next_seq = std::max(next_seq.load(), segment.max_seq + 1);
+    }
+
+    if (!open_segment(segments.empty() ? 0 : segments.back().index + 1)) {
+      return false;
+    }
+    flusher = std::thread([this] { flush_loop(); });
+    return true;
+  }
+
+  /**
+   * @brief write out and fsync all buffered records and stop the flusher.
+   */
+  void close() {
+    if (!flusher.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      stopped = true;
+    }
+    flush_cv.notify_one();
+    flusher.join();
+    ::close(fd);
+    fd = -1;
+  }
+
+  /**
+   * @brief append a record to the buffer of the calling thread.
+   * @return sequence number of the record
+   */
+  uint64_t append(uint8_t type, key_t key, key_t high_key, uint64_t value) {
+    char buf[sizeof(WalRecordHeader) + 2 * sizeof(key_t) + sizeof(uint64_t)];
+    auto header = reinterpret_cast<WalRecordHeader*>(buf);
+    header->type = type;
+    memset(header->pad, 0, sizeof(header->pad));
+    size_t len = sizeof(WalRecordHeader);
+    memcpy(buf + len, &key, sizeof(key_t));
+    len += sizeof(key_t);
+    if (type == WAL_DEL_RANGE) {
+      memcpy(buf + len, &high_key, sizeof(key_t));
+      len += sizeof(key_t);
+    } else if (type == WAL_PUT) {
+      memcpy(buf + len, &value, sizeof(uint64_t));
+      len += sizeof(uint64_t);
+    }
+
+    auto& slot = slots[ThreadSlot::id()];
+    std::lock_guard<std::mutex> guard(slot.mutex);
+    header->seq = next_seq.fetch_add(1);
+    header->crc = crc32c(buf + sizeof(uint32_t), len - sizeof(uint32_t));
+    slot.buf.insert(slot.buf.end(), buf, buf + len);
+    slot.max_seq = header->seq;
+    return header->seq;
+  }
+
+  /**
+   * @brief with WalSync::COMMIT, wait until the records appended by the
+   *        calling thread are durable. Returns at once otherwise.
+   */
+  void commit() {
+    if (options.sync != WalSync::COMMIT) {
+      return;
+    }
+    std::unique_lock<std::mutex> guard(mutex);
+    // a round that starts after this point drains the appended records
+    auto target = started_round + 1;
+    flush_requested = true;
+    flush_cv.notify_one();
+    done_cv.wait(guard, [&] { return completed_round >= target; });
+  }
+
+  /**
+   * @brief sequence number of the last appended record.
+   */
+  uint64_t last_seq() { return next_seq.load() - 1; }
+
+  /**
+   * @brief number later records after @p seq , e.g. the sequence number of a
+   *        checkpoint whose log segments were truncated.
+   */
+  void advance_seq(uint64_t seq) {
+    auto cur = next_seq.load();
+    while ((cur <= seq) && !next_seq.compare_exchange_weak(cur, seq + 1)) {
+    }
+  }
+
+  /**
+   * @brief delete segments whose records are all covered by a checkpoint
+   *        taken at @p seq . The current segment is closed first, so later
+   *        records go to a new one.
+   */
+  void truncate(uint64_t seq) {
+    std::lock_guard<std::mutex> guard(file_mutex);
+    if (segment_size) {
+      ::fdatasync(fd);
+      ::close(fd);
+      open_segment(segments.back().index + 1);
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < segments.size(); i++) {
+      if ((i + 1 < segments.size()) && (segments[i].max_seq <= seq)) {
+        ::unlink(segment_path(segments[i].index).c_str());
+      } else {
+        segments[kept++] = segments[i];
+      }
+    }
+    segments.resize(kept);
+  }
+
+  /**
+   * @brief read the valid records of all segments with sequence number
+   *        greater than @p after_seq , sorted by sequence number. A segment
+   *        is read up to its first torn or corrupt record.
+   */
+  std::vector<WalRecord<key_t>> read_records(uint64_t after_seq) {
+    std::vector<WalRecord<key_t>> records;
+    std::lock_guard<std::mutex> guard(file_mutex);
+    for (auto& segment : segments) {
+      read_segment(segment, [&](const WalRecord<key_t>& record) {
+        if (record.seq > after_seq) {
+          records.push_back(record);
+        }
+      });
+    }
+    std::sort(records.begin(), records.end(),
+              [](const WalRecord<key_t>& a, const WalRecord<key_t>& b) {
+                return a.seq < b.seq;
+              });
+    return records;
+  }
+
+ private:
+  struct Segment {
+    uint64_t index;
+    uint64_t max_seq;  // largest sequence number written to segment
+  };
+
+  struct alignas(64) Slot {
+    std::mutex mutex;
+    std::vector<char> buf;  // records appended by the owner thread
+    uint64_t max_seq = 0;
+  };
+
+  std::string segment_path(uint64_t index) {
+    return dir + "/wal." + std::to_string(index);
+  }
+
+  bool open_segment(uint64_t index) {
+    fd = ::open(segment_path(index).c_str(), O_WRONLY | O_CREAT | O_APPEND,
+                0644);
+    segments.push_back({index, 0});
+    segment_size = 0;
+    return fd >= 0;
+  }
+
+  template <typename F>
+  void read_segment(const Segment& segment, F&& fn) {
+    int in = ::open(segment_path(segment.index).c_str(), O_RDONLY);
+    if (in < 0) {
+      return;
+    }
+    std::vector<char> data;
+    char chunk[1 << 16];
+    ssize_t n;
+    while ((n = ::read(in, chunk, sizeof(chunk))) > 0) {
+      data.insert(data.end(), chunk, chunk + n);
+    }
+    ::close(in);
+
+    size_t pos = 0;
+    while (pos + sizeof(WalRecordHeader) <= data.size()) {
+      WalRecordHeader header;
+      memcpy(&header, data.data() + pos, sizeof(header));
+      size_t len = sizeof(header) + sizeof(key_t);
+      if (header.type == WAL_PUT) {
+        len += sizeof(uint64_t);
+      } else if (header.type == WAL_DEL_RANGE) {
+        len += sizeof(key_t);
+      } else if (header.type != WAL_DEL) {
+        return;
+      }
+      if ((pos + len > data.size()) ||
+          (header.crc != crc32c(data.data() + pos + sizeof(uint32_t),
+                                len - sizeof(uint32_t)))) {
+        return;
+      }
+
+      WalRecord<key_t> record = {};
+      record.seq = header.seq;
+      record.type = header.type;
+      auto payload = data.data() + pos + sizeof(header);
+      memcpy(&record.key, payload, sizeof(key_t));
+      if (header.type == WAL_PUT) {
+        memcpy(&record.value, payload + sizeof(key_t), sizeof(uint64_t));
+      } else if (header.type == WAL_DEL_RANGE) {
+        memcpy(&record.high_key, payload + sizeof(key_t), sizeof(key_t));
+      }
+      fn(record);
+      pos += len;
+    }
+  }
+
+  void flush_loop() {
+    std::vector<char> out;
+    std::vector<char> taken;
+    while (true) {
+      uint64_t round;
+      bool stopping;
+      {
+        std::unique_lock<std::mutex> guard(mutex);
+        flush_cv.wait_for(guard,
+                          std::chrono::microseconds(options.flush_interval_us),
+                          [&] { return flush_requested || stopped; });
+        flush_requested = false;
+        stopping = stopped;
+        round = ++started_round;
+      }
+
+      // drain every thread buffer, records keep their order per thread
+      out.clear();
+      uint64_t max_seq = 0;
+      for (auto& slot : slots) {
+        std::lock_guard<std::mutex> guard(slot.mutex);
+        if (slot.buf.empty()) {
+          continue;
+        }
+        taken.swap(slot.buf);
+        max_seq = std::max(max_seq, slot.max_seq);
+        out.insert(out.end(), taken.begin(), taken.end());
+        taken.clear();
+      }
+
+      {
+        std::lock_guard<std::mutex> guard(file_mutex);
+        if (!out.empty()) {
+          write_all(fd, out.data(), out.size());
+          segment_size += out.size();
+          segments.back().max_seq = std::max(segments.back().max_seq, max_seq);
+        }
+        if (!out.empty() && (options.sync != WalSync::NONE)) {
+          ::fdatasync(fd);
+        }
+        if (segment_size >= options.segment_bytes) {
+          ::close(fd);
+          open_segment(segments.back().index + 1);
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        completed_round = round;
+      }
+      done_cv.notify_all();
+      if (stopping) {
+        return;
+      }
+    }
+  }
+
+  std::string dir;
+  WalOptions options;
+  int fd;                 // current segment
+  uint64_t segment_size;  // bytes written to current segment
+  std::vector<Segment> segments;
+  std::mutex file_mutex;  // protects fd, segment_size and segments
+
+  std::atomic<uint64_t> next_seq;
+  Slot slots[MAX_THREADS];
+
+  std::mutex mutex;  // protects the fields below
+  std::condition_variable flush_cv;
+  std::condition_variable done_cv;
+  uint64_t started_round;
+  uint64_t completed_round;
+  bool flush_requested;
+  bool stopped;
+  std::thread flusher;
+};  // class WriteAheadLog
+
+}  // namespace BLINK_TREE
+
+#endif  // WAL_H_